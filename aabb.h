@@ -3,62 +3,75 @@
 
 #include "rtweekend.h"
 
-class aabb {
+template <typename T>
+class basic_aabb {
     public:
-    interval x, y, z;
-    aabb () {} // Default AABB is empty, like intervals by default.
-    aabb(const interval& ix, const interval& iy, const interval& iz) 
+    basic_interval<T> x, y, z;
+    basic_aabb () {} // Default AABB is empty, like intervals by default.
+    basic_aabb(const basic_interval<T>& ix, const basic_interval<T>& iy, const basic_interval<T>& iz) 
         : x(ix), y(iy), z(iz) {}
     
-    aabb(const point3& a, const point3& b){
+    basic_aabb(const basic_vec3<T>& a, const basic_vec3<T>& b){
         // Treat the two points as extrems of the bounding box.
-        x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
-        y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
-        z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+        x = basic_interval<T>(std::min(a[0], b[0]), std::max(a[0], b[0]));
+        y = basic_interval<T>(std::min(a[1], b[1]), std::max(a[1], b[1]));
+        z = basic_interval<T>(std::min(a[2], b[2]), std::max(a[2], b[2]));
     }
 
-    aabb(const aabb& box0, const aabb& box1) {
-        x = interval(box0.x, box1.x);
-        y = interval(box0.y, box1.y);
-        z = interval(box0.z, box1.z);
+    basic_aabb(const basic_aabb& box0, const basic_aabb& box1) {
+        x = basic_interval<T>(box0.x, box1.x);
+        y = basic_interval<T>(box0.y, box1.y);
+        z = basic_interval<T>(box0.z, box1.z);
     }
 
-    aabb pad() {
+    basic_aabb pad() const {
         // Return an AABB with no side smaller than delta, by adding padding.
-        double delta = 0.0001;
-        interval new_x = (x.size() >= delta) ? x : x.expand(delta);
-        interval new_y = (y.size() >= delta) ? y : y.expand(delta);
-        interval new_z = (z.size() >= delta) ? z : z.expand(delta);
+        T delta = 0.0001;
+        basic_interval<T> new_x = (x.size() >= delta) ? x : x.expand(delta);
+        basic_interval<T> new_y = (y.size() >= delta) ? y : y.expand(delta);
+        basic_interval<T> new_z = (z.size() >= delta) ? z : z.expand(delta);
 
-        return aabb(new_x, new_y, new_z);
+        return basic_aabb(new_x, new_y, new_z);
     }
 
-    const interval& axis(int n) const {
+    basic_vec3<T> centroid() const {
+        return basic_vec3<T>(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+    }
+
+    T surface_area() const {
+        // Area of the box surface, used by the surface area heuristic. Empty boxes have no area.
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        if (dx < 0 || dy < 0 || dz < 0) return 0;
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    const basic_interval<T>& axis(int n) const {
         if (n == 1) return y;
         if (n == 2) return z;
         return x;
     }
 
-    bool hit(const ray& r, interval ray_t) const {
-        for (int a = 0; a < 3; a++) {
-            auto invert_dir = 1/r.direction()[a];
-            auto orig = r.origin()[a];
-
-            auto t0 = (axis(a).min - orig) * invert_dir;
-            auto t1 = (axis(a).max - orig) * invert_dir;
+    bool hit(const basic_ray<T>& r, basic_interval<T> ray_t) const {
+        // Branchless slab test using the ray's cached reciprocal direction and signs. The sign
+        // picks which side of each slab the ray enters through, so no swap is needed.
+        // A zero direction component with the origin on a slab plane gives 0 * inf = NaN; the
+        // comparisons below are false for NaN, so that axis leaves the interval unchanged.
+        const basic_vec3<T>& orig = r.origin();
+        const basic_vec3<T>& invert_dir = r.invert_direction();
 
-            // If invert_dir is negative, the ray direction along this axis is negative
-            //  and the ray will hit the far side of the AABB before it hits the near side.
-            if (invert_dir < 0) std::swap(t0, t1);
+        for (int a = 0; a < 3; a++) {
+            const basic_interval<T>& slab = axis(a);
+            auto t0 = ((r.sign(a) ? slab.max : slab.min) - orig[a]) * invert_dir[a];
+            auto t1 = ((r.sign(a) ? slab.min : slab.max) - orig[a]) * invert_dir[a];
 
-            if(t0 > ray_t.min) ray_t.min = t0;
-            if(t1 < ray_t.max) ray_t.max = t1;
-            
-            if (ray_t.max <= ray_t.min) return false;
+            ray_t.min = (t0 > ray_t.min) ? t0 : ray_t.min;
+            ray_t.max = (t1 < ray_t.max) ? t1 : ray_t.max;
         }
-        return true;
+        return ray_t.min < ray_t.max;
     }
 
-}; 
+};
+
+using aabb = basic_aabb<real>;
 
 #endif
\ No newline at end of file
@@ -4,70 +4,358 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "thread_pool.h"
 #include "algorithm"
 
-class bvh_node : public hittable {
-    public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        auto objects = src_objects;
-
-        int axis = random_int(0, 2);
-        auto comparator = (axis = 0) ? box_x_compare : (axis = 1) ? box_y_compare : box_z_compare;
-
-        size_t object_span = end - start;
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            if (box_compare(objects[start], objects[start+1], axis)) {
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                left = objects[start+1];
-                right = objects[start];
+#include <atomic>
+#include <vector>
+
+// How a BVH node divides its primitives between the two children.
+enum class bvh_split {
+    median, // Split at the median primitive along the widest centroid axis.
+    sah     // Binned surface area heuristic over all three axes.
+};
+
+struct bvh_build_options {
+    bvh_split method = bvh_split::sah;
+    int max_leaf_size = 4; // Largest number of primitives stored in one leaf.
+    int bin_count = 16;    // Centroid bins per axis for the SAH split search, at most 32.
+    int thread_count = 0;  // Build threads, 0 uses one per hardware thread.
+};
+
+// Relative costs of a node traversal step and a primitive intersection test in the SAH.
+const double bvh_traversal_cost = 1.0;
+const double bvh_intersection_cost = 1.0;
+
+// Tree quality figures, used to compare BVH builders.
+struct bvh_stats {
+    int node_count = 0;
+    int leaf_count = 0;
+    int max_depth = 0;
+    int max_leaf_size = 0;
+    double sah_cost = 0; // Expected cost of a random ray, relative to one intersection test.
+};
+
+// A primitive seen by the builder: its bounds, their centroid and its position in the input.
+struct bvh_build_ref {
+    aabb box;
+    point3 centroid;
+    size_t index;
+};
+
+// Centroid bins of one range along each axis: the bounds and number of primitives in each bin.
+const int bvh_max_bins = 32;
+
+struct bvh_bins {
+    aabb boxes[3][bvh_max_bins];
+    size_t counts[3][bvh_max_bins] = {};
+};
+
+// Ranges of at least this many primitives build their two subtrees as parallel tasks...
+const size_t bvh_parallel_task_threshold = 1 << 12;
+// ...and ranges of at least this many also bin their centroids in parallel chunks.
+const size_t bvh_parallel_bin_threshold = 1 << 16;
+
+template <typename Body>
+void bvh_for_chunks(thread_pool* pool, size_t start, size_t end, size_t chunks, Body body) {
+    // Call body(chunk_start, chunk_end, chunk_index) over `chunks` even slices of [start, end).
+    if (chunks <= 1) {
+        body(start, end, 0);
+        return;
+    }
+
+    std::atomic<int> remaining(static_cast<int>(chunks));
+    auto size = end - start;
+    for (size_t c = 0; c < chunks; c++) {
+        auto chunk_start = start + size*c/chunks;
+        auto chunk_end = start + size*(c+1)/chunks;
+        pool->submit([&, chunk_start, chunk_end, c] {
+            body(chunk_start, chunk_end, c);
+            remaining--;
+        });
+    }
+    pool->wait(remaining);
+}
+
+inline size_t bvh_split_range(std::vector<bvh_build_ref>& refs, size_t start, size_t end,
+                              const bvh_build_options& options, thread_pool* pool = nullptr) {
+    // Reorder refs[start, end) so that the two children are refs[start, mid) and refs[mid, end),
+    // and return mid. Returns end when the range should become a leaf instead.
+    size_t count = end - start;
+    if (count <= 1) return end;
+
+    size_t chunks = 1;
+    if (pool && pool->size() > 1 && count >= bvh_parallel_bin_threshold)
+        chunks = std::min<size_t>(4 * pool->size(), count / (bvh_parallel_bin_threshold / 4));
+
+    aabb bounds, centroid_bounds;
+    auto bound_range = [&](size_t chunk_start, size_t chunk_end, aabb& box, aabb& centroid_box) {
+        for (size_t i = chunk_start; i < chunk_end; i++) {
+            box = aabb(box, refs[i].box);
+            centroid_box = aabb(centroid_box, aabb(refs[i].centroid, refs[i].centroid));
+        }
+    };
+
+    if (chunks == 1) {
+        bound_range(start, end, bounds, centroid_bounds);
+    } else {
+        std::vector<aabb> chunk_bounds(chunks), chunk_centroid_bounds(chunks);
+        bvh_for_chunks(pool, start, end, chunks, [&](size_t chunk_start, size_t chunk_end, size_t c) {
+            bound_range(chunk_start, chunk_end, chunk_bounds[c], chunk_centroid_bounds[c]);
+        });
+        for (size_t c = 0; c < chunks; c++) {
+            bounds = aabb(bounds, chunk_bounds[c]);
+            centroid_bounds = aabb(centroid_bounds, chunk_centroid_bounds[c]);
+        }
+    }
+
+    auto median_split = [&](int axis) {
+        auto mid = start + count/2;
+        std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+            [axis](const bvh_build_ref& a, const bvh_build_ref& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        return mid;
+    };
+
+    auto longest_axis = [&]() {
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (centroid_bounds.axis(a).size() > centroid_bounds.axis(axis).size()) axis = a;
+        return axis;
+    };
+
+    if (options.method == bvh_split::median) {
+        if (count <= static_cast<size_t>(options.max_leaf_size)) return end;
+        return median_split(longest_axis());
+    }
+
+    // Bin the centroids along every axis and sweep the bin boundaries for the cheapest split.
+    const int bins = std::min(std::max(options.bin_count, 2), bvh_max_bins);
+
+    double bin_scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+        auto size = centroid_bounds.axis(axis).size();
+        bin_scale[axis] = (size > 0) ? bins / size : 0;
+    }
+
+    auto bin_of = [&](const bvh_build_ref& ref, int axis) {
+        auto b = static_cast<int>((ref.centroid[axis] - centroid_bounds.axis(axis).min) * bin_scale[axis]);
+        return std::min(b, bins-1);
+    };
+
+    auto bin_range = [&](size_t chunk_start, size_t chunk_end, bvh_bins& result) {
+        for (size_t i = chunk_start; i < chunk_end; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                auto b = bin_of(refs[i], axis);
+                result.boxes[axis][b] = aabb(result.boxes[axis][b], refs[i].box);
+                result.counts[axis][b]++;
             }
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
         }
+    };
 
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+    bvh_bins binned;
+    if (chunks == 1) {
+        bin_range(start, end, binned);
+    } else {
+        std::vector<bvh_bins> chunk_bins(chunks);
+        bvh_for_chunks(pool, start, end, chunks, [&](size_t chunk_start, size_t chunk_end, size_t c) {
+            bin_range(chunk_start, chunk_end, chunk_bins[c]);
+        });
+        for (size_t c = 0; c < chunks; c++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < bins; b++) {
+                    binned.boxes[axis][b] = aabb(binned.boxes[axis][b], chunk_bins[c].boxes[axis][b]);
+                    binned.counts[axis][b] += chunk_bins[c].counts[axis][b];
+                }
+            }
+        }
+    }
+
+    double best_cost = infinity;
+    int best_axis = -1, best_bin = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (centroid_bounds.axis(axis).size() <= 0) continue;
+
+        const auto& bin_boxes = binned.boxes[axis];
+        const auto& bin_counts = binned.counts[axis];
+
+        // right_boxes[b] bounds bins b..bins-1.
+        aabb right_boxes[bvh_max_bins];
+        right_boxes[bins-1] = bin_boxes[bins-1];
+        for (int b = bins-2; b > 0; b--)
+            right_boxes[b] = aabb(right_boxes[b+1], bin_boxes[b]);
+
+        aabb left_box;
+        size_t left_count = 0;
+        for (int b = 1; b < bins; b++) {
+            left_box = aabb(left_box, bin_boxes[b-1]);
+            left_count += bin_counts[b-1];
+            auto right_count = count - left_count;
+            if (left_count == 0 || right_count == 0) continue;
+
+            auto cost = left_box.surface_area()*left_count + right_boxes[b].surface_area()*right_count;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    auto parent_area = bounds.surface_area();
+    auto leaf_cost = bvh_intersection_cost * count;
+    auto split_cost = (parent_area > 0)
+                    ? bvh_traversal_cost + bvh_intersection_cost * best_cost / parent_area
+                    : leaf_cost;
+
+    bool may_be_leaf = count <= static_cast<size_t>(options.max_leaf_size);
+    if (may_be_leaf && (best_axis < 0 || leaf_cost <= split_cost))
+        return end;
+
+    // Every centroid coincides: no plane separates them, so fall back to an even split.
+    if (best_axis < 0)
+        return median_split(0);
+
+    auto mid = std::partition(refs.begin() + start, refs.begin() + end,
+        [&](const bvh_build_ref& ref) { return bin_of(ref, best_axis) < best_bin; });
+
+    return static_cast<size_t>(mid - refs.begin());
+}
+
+template <typename BoxOf>
+std::vector<bvh_build_ref> bvh_gather_refs(size_t count, BoxOf box_of, thread_pool* pool) {
+    // One reference per primitive, with bounds box_of(i), gathered in parallel chunks for large inputs.
+    std::vector<bvh_build_ref> refs(count);
+
+    size_t chunks = 1;
+    if (pool && pool->size() > 1 && count >= bvh_parallel_bin_threshold)
+        chunks = 4 * pool->size();
+
+    bvh_for_chunks(pool, 0, count, chunks, [&](size_t chunk_start, size_t chunk_end, size_t) {
+        for (size_t i = chunk_start; i < chunk_end; i++) {
+            auto box = box_of(i);
+            refs[i] = {box, box.centroid(), i};
+        }
+    });
+
+    return refs;
+}
+
+inline std::vector<bvh_build_ref> bvh_gather_refs(const std::vector<shared_ptr<hittable>>& objects,
+                                                  thread_pool* pool) {
+    return bvh_gather_refs(objects.size(), [&](size_t i) { return objects[i]->bounding_box(); }, pool);
+}
+
+class bvh_node : public hittable {
+    public:
+    bvh_node(const hittable_list& list, const bvh_build_options& options = bvh_build_options()) {
+        // Build over a single array of references that is partitioned in place at every level.
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(list.objects, &pool);
+
+        if (!refs.empty())
+            build(list.objects, refs, 0, refs.size(), options, &pool);
     }
 
-    bool hit (const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
         if (!bbox.hit(r, ray_t)) return false;
 
-        bool hit_left = left->hit(r, ray_t, rec);
+        if (!left) {
+            bool hit_anything = false;
+            for (const auto& object : objects) {
+                if (object->intersect(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        }
+
+        bool hit_left = left->intersect(r, ray_t, rec);
         auto max_right_interval = hit_left ? rec.t : ray_t.max;
-        bool hit_right = right->hit(r, interval(ray_t.min, max_right_interval), rec);
+        bool hit_right = right->intersect(r, interval(ray_t.min, max_right_interval), rec);
 
         return hit_left || hit_right;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (!bbox.hit(r, ray_t)) return false;
+
+        if (!left) {
+            for (const auto& object : objects)
+                if (object->occluded(r, ray_t)) return true;
+            return false;
+        }
+
+        return left->occluded(r, ray_t) || right->occluded(r, ray_t);
+    }
+
     aabb bounding_box() const override { return bbox;}
 
+    bvh_stats stats() const {
+        bvh_stats result;
+        accumulate_stats(result, 1, bbox.surface_area());
+        return result;
+    }
+
     private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
+    shared_ptr<bvh_node> left;
+    shared_ptr<bvh_node> right;
+    std::vector<shared_ptr<hittable>> objects; // Primitives of a leaf node.
     aabb bbox;
 
-    static bool box_compare(const shared_ptr<hittable> box_a, const shared_ptr<hittable> box_b, int axis_index){
-        return box_a->bounding_box().axis(axis_index).min < box_b->bounding_box().axis(axis_index).min;
+    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, std::vector<bvh_build_ref>& refs,
+             size_t start, size_t end, const bvh_build_options& options, thread_pool* pool) {
+        build(src_objects, refs, start, end, options, pool);
     }
 
-    static bool box_x_compare(const shared_ptr<hittable> box_a, const shared_ptr<hittable> box_b){
-        return box_compare(box_a, box_b, 0);
-    }
-    
-    static bool box_y_compare(const shared_ptr<hittable> box_a, const shared_ptr<hittable> box_b){
-        return box_compare(box_a, box_b, 1);
+    void build(const std::vector<shared_ptr<hittable>>& src_objects, std::vector<bvh_build_ref>& refs,
+               size_t start, size_t end, const bvh_build_options& options, thread_pool* pool) {
+        auto mid = bvh_split_range(refs, start, end, options, pool);
+
+        if (mid == end) {
+            for (size_t i = start; i < end; i++) {
+                objects.push_back(src_objects[refs[i].index]);
+                bbox = aabb(bbox, refs[i].box);
+            }
+            return;
+        }
+
+        // Large subtrees build their left half as a task while this thread builds the right half.
+        if (pool->size() > 1 && end - start >= bvh_parallel_task_threshold) {
+            std::atomic<int> remaining(1);
+            pool->submit([&] {
+                left = shared_ptr<bvh_node>(new bvh_node(src_objects, refs, start, mid, options, pool));
+                remaining--;
+            });
+            right = shared_ptr<bvh_node>(new bvh_node(src_objects, refs, mid, end, options, pool));
+            pool->wait(remaining);
+        } else {
+            left = shared_ptr<bvh_node>(new bvh_node(src_objects, refs, start, mid, options, pool));
+            right = shared_ptr<bvh_node>(new bvh_node(src_objects, refs, mid, end, options, pool));
+        }
+        bbox = aabb(left->bounding_box(), right->bounding_box());
     }
-    
-    static bool box_z_compare(const shared_ptr<hittable> box_a, const shared_ptr<hittable> box_b){
-        return box_compare(box_a, box_b, 2);
+
+    void accumulate_stats(bvh_stats& result, int depth, double root_area) const {
+        auto relative_area = (root_area > 0) ? bbox.surface_area() / root_area : 1.0;
+
+        result.node_count++;
+        result.max_depth = std::max(result.max_depth, depth);
+
+        if (!left) {
+            result.leaf_count++;
+            result.max_leaf_size = std::max(result.max_leaf_size, static_cast<int>(objects.size()));
+            result.sah_cost += relative_area * bvh_intersection_cost * objects.size();
+            return;
+        }
+
+        result.sah_cost += relative_area * bvh_traversal_cost;
+        left->accumulate_stats(result, depth+1, root_area);
+        right->accumulate_stats(result, depth+1, root_area);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
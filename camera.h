@@ -2,11 +2,24 @@
 #define CAMERA_H
 
 #include "rtweekend.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "lights.h"
 #include "material.h"
+#include "sampler.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
 
 /* Two main functions:
    1. Construct and dispatch rays into the world.
@@ -17,39 +30,106 @@ class camera {
     public:
     
     // Aspect ratio
-    double aspect_ratio = 16.0 / 9.0; // image width over height ratio.
+    real aspect_ratio = 16.0 / 9.0; // image width over height ratio.
     int image_width = 800; // Rendered image width in pixel count.
-    int samples_per_pixel = 10; //Count of random samples for each pixel.
+    int samples_per_pixel = 10; //Count of random samples for each pixel, the most an adaptive pixel takes.
     int max_depth = 10; // Max number of ray bounces into scene.
+    int max_diffuse_depth = 1 << 20; // Max diffuse bounces on one path, counted within max_depth.
+    int max_specular_depth = 1 << 20; // Max mirror and glass reflections on one path.
+    int max_transmission_depth = 1 << 20; // Max refractions through glass on one path.
+    int roulette_depth = 5; // Bounces after which Russian roulette may end a path; max_depth disables it.
 
-    double vertical_field_view = 90; // Vertical view angle (field of view)
+    real vertical_field_view = 90; // Vertical view angle (field of view)
     point3 lookfrom = point3(0, 0, -1); // Point camera is looking from.
     point3 lookat = point3(0, 0, 0); // Point camera is looking at.
     vec3 v_up = vec3(0, 1, 0); // Cmaera-relative "up" direction
 
-    double defocus_angle = 0; // Variation angle of rays through each pixel.
-    double focus_distance = 10; // Distance from camera lookfrom point to plane of perfect focus.
+    real defocus_angle = 0; // Variation angle of rays through each pixel.
+    real focus_distance = 10; // Distance from camera lookfrom point to plane of perfect focus.
 
-    void render(const hittable &world) {
-        initialize();
+    int thread_count = 0; // Render threads, 0 uses one per hardware thread.
+    int tile_size = 16; // Edge length in pixels of the square tiles handed out to the threads.
+    uint64_t seed = 0; // Seed of the per-pixel sample streams; equal seeds give identical images.
+    sample_pattern sampling = sample_pattern::independent; // Where each sample's random numbers come from.
+    std::string output_file; // .ppm, .pfm or .exr; empty writes a PPM to standard output.
+    bool sky = true; // Light rays that hit nothing with a sky gradient, or else with background.
+    color background = color(0,0,0);
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    // Adaptive sampling: a tile stops once the estimated error of its pixels, in display units,
+    // drops below adaptive_threshold, taking between min_samples and samples_per_pixel samples.
+    bool adaptive = false;
+    int min_samples = 16;
+    real adaptive_threshold = 0.005;
+    std::string heatmap_file; // Optional image of samples taken per pixel, relative to samples_per_pixel.
 
-        for (int j = 0; j < image_height; ++j)
-        {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i)
-            {
-                color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample){
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
-                write_color(std::cout, pixel_color, samples_per_pixel);
+    // Wavefront mode renders breadth-first: batches of paths advance one bounce at a time, stage
+    // by stage, with the hits of each bounce queued by material class. It gives the same image as
+    // the tile renderer, always at samples_per_pixel, and reports queue sizes and stage times.
+    bool wavefront = false;
+    int wavefront_batch = 1 << 18; // Paths in flight at once, rounded down to whole pixels.
+
+    // Trace the camera rays of each sample in packets over blocks of packet_width by
+    // packet_height pixels; later bounces go ray by ray. Same image; not used by adaptive tiles.
+    bool packets = false;
+
+    // Progressive mode renders the whole image in passes of pass_samples samples per pixel
+    // (min_samples when adaptive), writing output_file as a preview after every pass. The sums
+    // and sample counts go to checkpoint_file after the last pass and after any pass ending
+    // checkpoint_interval seconds or more after the previous checkpoint. With resume set, the
+    // render continues from checkpoint_file; the finished image is the same as without a break.
+    // A render with max_passes set stops after that many passes, to be resumed later.
+    bool progressive = false;
+    int pass_samples = 16;
+    std::string checkpoint_file;
+    real checkpoint_interval = 300;
+    bool resume = false;
+    int max_passes = 0; // 0 renders every pass.
+
+    void render(const hittable &world, const material_table& materials) {
+        render(world, materials, light_list());
+    }
+
+    // Render with next-event estimation towards the given lights, which should be the emissive
+    // primitives of world.
+    void render(const hittable &world, const material_table& materials, const light_list& lights) {
+        for (const auto& path : {output_file, heatmap_file}) {
+            if (!is_image_path(path)) {
+                std::clog << "Unknown image format '" << path << "', expected .ppm, .pfm or .exr.\n";
+                return;
             }
-        
         }
-        std::clog << "\rDone.              \n";
+
+        initialize();
+
+        // Render every tile into the framebuffer, then write the whole image out at once.
+        framebuffer image(image_width, image_height);
+        std::vector<int> sample_counts(image_width * image_height);
+        if (wavefront) {
+            if (adaptive) std::clog << "Adaptive sampling is not available in wavefront mode.\n";
+            render_wavefront(world, materials, lights, image, sample_counts);
+        } else if (progressive) {
+            if (!render_progressive(world, materials, lights, image, sample_counts)) return;
+        } else {
+            render_tiles(world, materials, lights, image, sample_counts);
+        }
+
+        if (!write_image(output_file, image)) {
+            std::clog << "\rCould not write the image to '" << output_file << "'.\n";
+            return;
+        }
+
+        if (adaptive && !wavefront) {
+            double total = 0;
+            for (auto count : sample_counts) total += count;
+            std::clog << "\rAverage samples per pixel: " << total / sample_counts.size() << '\n';
+        }
+
+        if (!heatmap_file.empty() && !write_image(heatmap_file, sample_heatmap(sample_counts))) {
+            std::clog << "\rCould not write the heatmap to '" << heatmap_file << "'.\n";
+            return;
+        }
+
+        std::clog << "\rDone.                    \n";
     }
 
     private:
@@ -63,6 +143,511 @@ class camera {
     vec3 defocus_disk_u; // Defocus disk horizontal radius.
     vec3 defocus_disk_v; // Defocus disk vertical radius.
 
+    // A path between bounces: the ray it continues along and what it has gathered so far.
+    struct path_state {
+        ray r;
+        color throughput = color(1, 1, 1); // Product of the attenuations along the path so far.
+        color radiance = color(0, 0, 0);
+        real scatter_pdf = 0; // Density of r at the bounce that chose it; 0 if the lights were not sampled there.
+        int bounces[3] = {0, 0, 0}; // Per bounce_kind.
+    };
+
+    // Shadow ray of a light sample, and the light it adds to its path unless something blocks it.
+    struct shadow_request {
+        ray r;
+        real max_t;
+        color contribution;
+        bool pending = false;
+    };
+
+    void render_tiles(const hittable& world, const material_table& materials, const light_list& lights,
+                      framebuffer& image, std::vector<int>& sample_counts) const {
+        thread_pool pool(thread_count);
+
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        std::atomic<int> tiles_remaining(tiles_x * tiles_y);
+        std::mutex log_lock;
+
+        std::clog << "Rendering " << tiles_x * tiles_y << " tiles on " << pool.size() << " threads.\n";
+
+        for (int tile_j = 0; tile_j < tiles_y; ++tile_j) {
+            for (int tile_i = 0; tile_i < tiles_x; ++tile_i) {
+                pool.submit([&, tile_i, tile_j] {
+                    render_tile(world, materials, lights, image, sample_counts, tile_i * tile_size, tile_j * tile_size);
+
+                    auto remaining = --tiles_remaining;
+                    std::lock_guard<std::mutex> guard(log_lock);
+                    std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+                });
+            }
+        }
+
+        pool.wait();
+    }
+
+    void render_tile(const hittable& world, const material_table& materials, const light_list& lights,
+                     framebuffer& image, std::vector<int>& sample_counts, int x0, int y0) const {
+        int x1 = std::min(x0 + tile_size, image_width);
+        int y1 = std::min(y0 + tile_size, image_height);
+
+        // Every random_double() of this tile's samples, in the camera and the materials alike,
+        // comes from the tile's sampler.
+        auto tile_sampler = make_sampler(sampling, seed, samples_per_pixel, image_width);
+        sampler_scope scope(tile_sampler.get());
+
+        if (adaptive) {
+            render_tile_adaptive(world, materials, lights, image, sample_counts, *tile_sampler, x0, y0, x1, y1);
+            return;
+        }
+        if (packets) {
+            render_tile_packets(world, materials, lights, image, sample_counts, *tile_sampler, x0, y0, x1, y1);
+            return;
+        }
+
+        for (int j = y0; j < y1; ++j) {
+            for (int i = x0; i < x1; ++i) {
+                color pixel_color(0,0,0);
+                for (int sample = 0; sample < samples_per_pixel; ++sample){
+                    tile_sampler->start_sample(i, j, sample);
+                    ray r = get_ray(i, j);
+                    pixel_color += ray_color(r, world, materials, lights);
+                }
+                image.set(i, j, pixel_color / samples_per_pixel);
+                sample_counts[j * image_width + i] = samples_per_pixel;
+            }
+        }
+    }
+
+    static const int packet_width = 4;
+    static const int packet_height = ray_packet_size / packet_width;
+
+    void render_tile_packets(const hittable& world, const material_table& materials, const light_list& lights,
+                             framebuffer& image, std::vector<int>& sample_counts, sampler& tile_sampler,
+                             int x0, int y0, int x1, int y1) const {
+        // Sample by sample, the camera rays of a pixel block first hit the world as one packet.
+        // Each path then resumes its sampler where its camera ray left off, so it draws the same
+        // numbers as in render_tile.
+        for (int block_y = y0; block_y < y1; block_y += packet_height) {
+            for (int block_x = x0; block_x < x1; block_x += packet_width) {
+                int xs[ray_packet_size], ys[ray_packet_size];
+                int count = 0;
+                for (int j = block_y; j < std::min(block_y + packet_height, y1); ++j) {
+                    for (int i = block_x; i < std::min(block_x + packet_width, x1); ++i) {
+                        xs[count] = i;
+                        ys[count] = j;
+                        count++;
+                    }
+                }
+
+                color pixel_colors[ray_packet_size];
+                ray rays[ray_packet_size];
+                hit_record recs[ray_packet_size];
+                bool hits[ray_packet_size];
+                uint64_t dimensions[ray_packet_size];
+                for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                    for (int k = 0; k < count; k++) {
+                        tile_sampler.start_sample(xs[k], ys[k], sample);
+                        rays[k] = get_ray(xs[k], ys[k]);
+                        dimensions[k] = tile_sampler.current_dimension();
+                    }
+
+                    world.hit_packet(rays, count, interval(0, infinity), recs, hits);
+
+                    for (int k = 0; k < count; k++) {
+                        tile_sampler.resume_sample(xs[k], ys[k], sample, dimensions[k]);
+                        pixel_colors[k] += trace_path(rays[k], hits[k], recs[k], world, materials, lights);
+                    }
+                }
+
+                for (int k = 0; k < count; k++) {
+                    image.set(xs[k], ys[k], pixel_colors[k] / samples_per_pixel);
+                    sample_counts[ys[k] * image_width + xs[k]] = samples_per_pixel;
+                }
+            }
+        }
+    }
+
+    void render_tile_adaptive(const hittable& world, const material_table& materials, const light_list& lights,
+                              framebuffer& image, std::vector<int>& sample_counts, sampler& tile_sampler,
+                              int x0, int y0, int x1, int y1) const {
+        // Sample the tile in passes of min_samples per pixel. Besides each pixel's sum, keep the
+        // sum of its even numbered samples: the two means differ by about the standard error of
+        // the full mean, which gives an error estimate without tracking per-sample statistics.
+        // The tile stops once the average of that difference, in display units, falls below
+        // adaptive_threshold; judging a whole tile keeps one unlucky run of samples from stopping
+        // a single pixel too early.
+        int width = x1 - x0;
+        int height = y1 - y0;
+        std::vector<color> sums(width * height), even_sums(width * height);
+
+        int pass = std::max(min_samples, 2);
+        int samples = 0;
+        while (samples < samples_per_pixel) {
+            int pass_end = std::min(samples + pass, samples_per_pixel);
+            for (int j = y0; j < y1; ++j) {
+                for (int i = x0; i < x1; ++i) {
+                    auto index = (j - y0) * width + (i - x0);
+                    for (int sample = samples; sample < pass_end; ++sample) {
+                        tile_sampler.start_sample(i, j, sample);
+                        ray r = get_ray(i, j);
+                        auto sample_color = ray_color(r, world, materials, lights);
+                        sums[index] += sample_color;
+                        if (sample % 2 == 0) even_sums[index] += sample_color;
+                    }
+                }
+            }
+            samples = pass_end;
+
+            if (tile_error(sums, even_sums, samples) < adaptive_threshold)
+                break;
+        }
+
+        for (int j = y0; j < y1; ++j) {
+            for (int i = x0; i < x1; ++i) {
+                image.set(i, j, sums[(j - y0) * width + (i - x0)] / samples);
+                sample_counts[j * image_width + i] = samples;
+            }
+        }
+    }
+
+    bool render_progressive(const hittable& world, const material_table& materials, const light_list& lights,
+                            framebuffer& image, std::vector<int>& sample_counts) const {
+        // Each pass gives every unfinished tile its next samples, in the same passes and with the
+        // same stopping test as render_tile_adaptive when adaptive, so that every pixel sums the
+        // same samples in the same order as in render_tiles. Returns false if resuming fails.
+        render_checkpoint state(image_width, image_height);
+        state.samples_per_pixel = samples_per_pixel;
+        state.pattern = static_cast<int32_t>(sampling);
+        state.adaptive = adaptive;
+        state.tile_size = tile_size;
+        state.min_samples = min_samples;
+        state.seed = seed;
+        state.adaptive_threshold = adaptive_threshold;
+
+        if (resume && !checkpoint_file.empty()) {
+            render_checkpoint saved;
+            if (!read_checkpoint(checkpoint_file, saved)) {
+                std::clog << "No usable checkpoint at '" << checkpoint_file << "', starting from the first sample.\n";
+            } else if (!saved.same_settings(state)) {
+                std::clog << "The checkpoint '" << checkpoint_file << "' was rendered with other settings.\n";
+                return false;
+            } else {
+                state = std::move(saved);
+            }
+        }
+
+        thread_pool pool(thread_count);
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        int pass = adaptive ? std::max(min_samples, 2) : std::max(pass_samples, 1);
+        std::clog << "Rendering " << tiles_x * tiles_y << " tiles in passes of " << pass
+                  << " samples per pixel on " << pool.size() << " threads.\n";
+
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        for (int pass_count = 1; ; pass_count++) {
+            int tiles_rendered = 0;
+            for (int tile_j = 0; tile_j < tiles_y; ++tile_j) {
+                for (int tile_i = 0; tile_i < tiles_x; ++tile_i) {
+                    int x0 = tile_i * tile_size, y0 = tile_j * tile_size;
+                    if (tile_finished(state, x0, y0)) continue;
+                    tiles_rendered++;
+                    pool.submit([&, x0, y0] { render_tile_pass(world, materials, lights, state, x0, y0, pass); });
+                }
+            }
+            pool.wait();
+            if (tiles_rendered == 0) break;
+            bool last_pass = pass_count == max_passes;
+
+            resolve(state, image);
+            if (!output_file.empty() && !write_image(output_file, image))
+                std::clog << "\rCould not write the preview to '" << output_file << "'.\n";
+
+            auto now = std::chrono::steady_clock::now();
+            if (!checkpoint_file.empty() && std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval) {
+                if (!write_checkpoint(checkpoint_file, state))
+                    std::clog << "\rCould not write the checkpoint to '" << checkpoint_file << "'.\n";
+                last_checkpoint = now;
+            }
+            std::clog << "\rPass " << pass_count << ": " << tiles_rendered << " tiles  " << std::flush;
+            if (last_pass) break;
+        }
+
+        if (!checkpoint_file.empty() && !write_checkpoint(checkpoint_file, state))
+            std::clog << "\rCould not write the checkpoint to '" << checkpoint_file << "'.\n";
+
+        resolve(state, image);
+        sample_counts.assign(state.counts.begin(), state.counts.end());
+        return true;
+    }
+
+    bool tile_finished(const render_checkpoint& state, int x0, int y0) const {
+        // Whether every pixel of the tile at (x0, y0) has taken all its samples, or, when
+        // adaptive, the tile has passed the error test after its last pass. Adaptive tiles are
+        // those of the checkpoint, so all their pixels have taken the same samples.
+        int x1 = std::min(x0 + tile_size, image_width);
+        int y1 = std::min(y0 + tile_size, image_height);
+        int samples = samples_per_pixel;
+        for (int j = y0; j < y1; ++j)
+            for (int i = x0; i < x1; ++i)
+                samples = std::min(samples, state.counts[size_t(j) * image_width + i]);
+        if (samples >= samples_per_pixel) return true;
+        if (!adaptive || samples == 0) return false;
+
+        std::vector<color> sums, even_sums;
+        for (int j = y0; j < y1; ++j) {
+            for (int i = x0; i < x1; ++i) {
+                sums.push_back(state.sums[size_t(j) * image_width + i]);
+                even_sums.push_back(state.even_sums[size_t(j) * image_width + i]);
+            }
+        }
+        return tile_error(sums, even_sums, samples) < adaptive_threshold;
+    }
+
+    void render_tile_pass(const hittable& world, const material_table& materials, const light_list& lights,
+                          render_checkpoint& state, int x0, int y0, int pass) const {
+        int x1 = std::min(x0 + tile_size, image_width);
+        int y1 = std::min(y0 + tile_size, image_height);
+
+        auto tile_sampler = make_sampler(sampling, seed, samples_per_pixel, image_width);
+        sampler_scope scope(tile_sampler.get());
+
+        for (int j = y0; j < y1; ++j) {
+            for (int i = x0; i < x1; ++i) {
+                // Each pixel continues from its own count, which a checkpoint written with other
+                // tiles need not share with the rest of this tile.
+                auto index = size_t(j) * image_width + i;
+                int samples = state.counts[index];
+                int pass_end = std::min(samples + pass, samples_per_pixel);
+                for (int sample = samples; sample < pass_end; ++sample) {
+                    tile_sampler->start_sample(i, j, sample);
+                    ray r = get_ray(i, j);
+                    auto sample_color = ray_color(r, world, materials, lights);
+                    state.sums[index] += sample_color;
+                    if (sample % 2 == 0) state.even_sums[index] += sample_color;
+                }
+                state.counts[index] = pass_end;
+            }
+        }
+    }
+
+    void resolve(const render_checkpoint& state, framebuffer& image) const {
+        // The mean of each pixel's samples so far; black before its first sample.
+        for (int j = 0; j < image_height; ++j) {
+            for (int i = 0; i < image_width; ++i) {
+                auto index = size_t(j) * image_width + i;
+                auto samples = state.counts[index];
+                image.set(i, j, samples > 0 ? state.sums[index] / samples : color(0,0,0));
+            }
+        }
+    }
+
+    // A path of the wavefront renderer, with the sample it belongs to.
+    struct wavefront_path {
+        path_state state;
+        hit_record rec;
+        shadow_request shadow;
+        int x, y, sample;
+        uint64_t dimension; // Sampler position, to resume the sample's numbers at the next stage.
+        bool alive;
+    };
+
+    struct wavefront_stats {
+        static const int stage_count = 6;
+        std::vector<size_t> paths;               // Per depth: paths traced.
+        std::vector<std::vector<size_t>> queues; // Per depth and material class: hits shaded.
+        std::vector<size_t> shadow_rays;         // Per depth.
+        double seconds[stage_count] = {};        // Per stage, as named in report_wavefront.
+    };
+
+    template <typename Body>
+    static void parallel_for(thread_pool& pool, size_t count, const Body& body) {
+        // body(begin, end) over chunks of [0, count) spread over the pool; returns when all are done.
+        const size_t chunk = 2048;
+        for (size_t begin = 0; begin < count; begin += chunk) {
+            auto end = std::min(begin + chunk, count);
+            pool.submit([&body, begin, end] { body(begin, end); });
+        }
+        pool.wait();
+    }
+
+    void render_wavefront(const hittable& world, const material_table& materials, const light_list& lights,
+                          framebuffer& image, std::vector<int>& sample_counts) const {
+        // Each batch holds every sample of a run of pixels. A path keeps its sampler position
+        // between stages, so it draws exactly the numbers it would in the tile renderer, and each
+        // pixel sums its samples in the same order: both modes give the same image.
+        thread_pool pool(thread_count);
+        int pixel_count = image_width * image_height;
+        int batch_pixels = std::max(1, wavefront_batch / samples_per_pixel);
+        int batch_count = (pixel_count + batch_pixels - 1) / batch_pixels;
+        std::clog << "Rendering " << batch_count << " batches of up to " << size_t(batch_pixels) * samples_per_pixel
+                  << " paths on " << pool.size() << " threads.\n";
+
+        wavefront_stats stats;
+        std::vector<wavefront_path> paths;
+        std::vector<uint32_t> active, survivors, shadows;
+        std::vector<std::vector<uint32_t>> queues(materials.type_count());
+
+        auto stage_start = std::chrono::steady_clock::now();
+        auto end_stage = [&](int stage) {
+            auto now = std::chrono::steady_clock::now();
+            stats.seconds[stage] += std::chrono::duration<double>(now - stage_start).count();
+            stage_start = now;
+        };
+
+        for (int first = 0; first < pixel_count; first += batch_pixels) {
+            int last = std::min(first + batch_pixels, pixel_count);
+            paths.resize(size_t(last - first) * samples_per_pixel);
+
+            // Camera rays, pixel by pixel and sample by sample.
+            parallel_for(pool, paths.size(), [&](size_t begin, size_t end) {
+                auto path_sampler = make_sampler(sampling, seed, samples_per_pixel, image_width);
+                sampler_scope scope(path_sampler.get());
+                for (size_t k = begin; k < end; k++) {
+                    auto& path = paths[k];
+                    int pixel = first + static_cast<int>(k / samples_per_pixel);
+                    path.x = pixel % image_width;
+                    path.y = pixel / image_width;
+                    path.sample = static_cast<int>(k % samples_per_pixel);
+                    path_sampler->start_sample(path.x, path.y, path.sample);
+                    path.state = path_state();
+                    path.state.r = get_ray(path.x, path.y);
+                    path.dimension = path_sampler->current_dimension();
+                }
+            });
+            active.resize(paths.size());
+            std::iota(active.begin(), active.end(), 0);
+            end_stage(0);
+
+            for (int depth = 0; depth < max_depth && !active.empty(); depth++) {
+                if (stats.paths.size() <= size_t(depth)) {
+                    stats.paths.push_back(0);
+                    stats.queues.emplace_back(queues.size());
+                    stats.shadow_rays.push_back(0);
+                }
+                stats.paths[depth] += active.size();
+
+                // Closest hits. Paths that miss end here, lit by the background.
+                parallel_for(pool, active.size(), [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++) {
+                        auto& path = paths[active[k]];
+                        path.shadow.pending = false;
+                        path.alive = world.hit(path.state.r, interval(0, infinity), path.rec);
+                        if (!path.alive)
+                            path.state.radiance += path.state.throughput * miss_color(path.state.r);
+                    }
+                });
+                end_stage(1);
+
+                for (auto& queue : queues) queue.clear();
+                for (auto index : active)
+                    if (paths[index].alive) queues[materials.type_of(paths[index].rec.mat)].push_back(index);
+                end_stage(2);
+
+                // One queue at a time, so that each stretch runs a single scatter() implementation.
+                for (size_t type = 0; type < queues.size(); type++) {
+                    const auto& queue = queues[type];
+                    stats.queues[depth][type] += queue.size();
+                    parallel_for(pool, queue.size(), [&](size_t begin, size_t end) {
+                        auto path_sampler = make_sampler(sampling, seed, samples_per_pixel, image_width);
+                        sampler_scope scope(path_sampler.get());
+                        for (size_t k = begin; k < end; k++) {
+                            auto& path = paths[queue[k]];
+                            path_sampler->resume_sample(path.x, path.y, path.sample, path.dimension);
+                            path.alive = shade(path.state, path.rec, depth, materials, lights, path.shadow);
+                            path.dimension = path_sampler->current_dimension();
+                        }
+                    });
+                }
+                end_stage(3);
+
+                // Shadow rays of the light samples taken while shading.
+                shadows.clear();
+                for (auto index : active)
+                    if (paths[index].shadow.pending) shadows.push_back(index);
+                stats.shadow_rays[depth] += shadows.size();
+                parallel_for(pool, shadows.size(), [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++) {
+                        auto& path = paths[shadows[k]];
+                        if (!world.occluded(path.shadow.r, interval(0, path.shadow.max_t)))
+                            path.state.radiance += path.shadow.contribution;
+                    }
+                });
+                end_stage(4);
+
+                // Compact the surviving paths for the next bounce.
+                survivors.clear();
+                for (auto index : active)
+                    if (paths[index].alive) survivors.push_back(index);
+                active.swap(survivors);
+                end_stage(2);
+            }
+
+            for (int pixel = first; pixel < last; pixel++) {
+                color pixel_color(0,0,0);
+                for (int sample = 0; sample < samples_per_pixel; sample++)
+                    pixel_color += paths[size_t(pixel - first) * samples_per_pixel + sample].state.radiance;
+                image.set(pixel % image_width, pixel / image_width, pixel_color / samples_per_pixel);
+                sample_counts[pixel] = samples_per_pixel;
+            }
+            end_stage(5);
+
+            std::clog << "\rBatches remaining: " << (pixel_count - last + batch_pixels - 1) / batch_pixels << ' ' << std::flush;
+        }
+
+        report_wavefront(stats, materials);
+    }
+
+    static void report_wavefront(const wavefront_stats& stats, const material_table& materials) {
+        // Paths entering each bounce, the hits shaded per material class, the shadow rays traced,
+        // and the time spent in each stage, over all batches.
+        std::clog << "\rWavefront queues:          \n";
+        std::clog << "depth       paths";
+        for (int type = 0; type < materials.type_count(); type++)
+            std::clog << std::setw(15) << materials.type_name(type);
+        std::clog << "     shadow\n";
+        for (size_t depth = 0; depth < stats.paths.size(); depth++) {
+            std::clog << std::left << std::setw(6) << depth << std::right << std::setw(11) << stats.paths[depth];
+            for (auto size : stats.queues[depth])
+                std::clog << std::setw(15) << size;
+            std::clog << std::setw(11) << stats.shadow_rays[depth] << '\n';
+        }
+
+        const char* stage_names[wavefront_stats::stage_count] = {
+            "camera rays", "intersect", "queue", "shade", "shadow rays", "accumulate"
+        };
+        std::clog << "Stage times (s):";
+        for (int stage = 0; stage < wavefront_stats::stage_count; stage++)
+            std::clog << "  " << stage_names[stage] << ' ' << std::fixed << std::setprecision(3) << stats.seconds[stage];
+        std::clog << std::defaultfloat << '\n';
+    }
+
+    static real tile_error(const std::vector<color>& sums, const std::vector<color>& even_sums, int samples) {
+        // Mean difference between the full and the even-sample estimate of each pixel, after the
+        // gamma 2 display transform.
+        int even_samples = (samples + 1) / 2;
+        real error = 0;
+        for (size_t k = 0; k < sums.size(); k++) {
+            auto full = std::sqrt(std::max(real(0), luminance(sums[k]) / samples));
+            auto even = std::sqrt(std::max(real(0), luminance(even_sums[k]) / even_samples));
+            error += std::fabs(full - even);
+        }
+        return error / sums.size();
+    }
+
+    framebuffer sample_heatmap(const std::vector<int>& sample_counts) const {
+        // Grey level = share of the sample budget a pixel used (shown through the gamma 2 transform
+        // in a PPM, linear in PFM and EXR).
+        framebuffer heatmap(image_width, image_height);
+        for (int j = 0; j < image_height; ++j) {
+            for (int i = 0; i < image_width; ++i) {
+                real used = real(sample_counts[j * image_width + i]) / samples_per_pixel;
+                heatmap.set(i, j, color(used, used, used));
+            }
+        }
+        return heatmap;
+    }
+
     void initialize(){
         // Calculate image height.
         image_height = static_cast<int>(image_width / aspect_ratio);
@@ -77,7 +662,7 @@ class camera {
         
         // Render viewport (from where we will be looking at the 3D space) 
         auto viewport_height = 2 * h * focus_distance;
-        auto viewport_width = viewport_height * (static_cast<double>(image_width)/image_height);
+        auto viewport_width = viewport_height * (static_cast<real>(image_width)/image_height);
 
         //calculate the u, v, w unit basis vectors for the camera coordinate frame.
         w = unit_vector(lookfrom - lookat);
@@ -103,24 +688,119 @@ class camera {
         defocus_disk_v = v * defocus_radius;
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    color ray_color(const ray& camera_ray, const hittable& world, const material_table& materials,
+                    const light_list& lights) const {
         hit_record rec;
-        
-        //If we've exceeded the ray bount limit, no more light is gathered.
-        if (depth <= 0)
-            return color(0,0,0);
+        bool hit = world.hit(camera_ray, interval(0, infinity), rec);
+        return trace_path(camera_ray, hit, rec, world, materials, lights);
+    }
 
+    color trace_path(const ray& camera_ray, bool camera_hit, hit_record rec, const hittable& world,
+                     const material_table& materials, const light_list& lights) const {
+        // Iterative path tracer, from the camera ray's closest hit (rec, if camera_hit): the path
+        // ends when it escapes, is absorbed, runs out of bounces of some kind, or is stopped by
+        // Russian roulette (see shade).
+        path_state path;
+        path.r = camera_ray;
 
-        if (world.hit(r, interval(0.0001, infinity), rec)) {
-            ray scattered;
-            color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered)){
-                return attenuation * ray_color(scattered, depth-1, world);
+        for (int depth = 0; depth < max_depth; depth++) {
+            // Secondary rays are already offset from their surface (hit_record::spawn_ray).
+            bool hit = (depth == 0) ? camera_hit : world.hit(path.r, interval(0, infinity), rec);
+            if (!hit) {
+                path.radiance += path.throughput * miss_color(path.r);
+                break;
             }
-            return color(0,0,0);
+
+            shadow_request shadow;
+            bool alive = shade(path, rec, depth, materials, lights, shadow);
+            if (shadow.pending && !world.occluded(shadow.r, interval(0, shadow.max_t)))
+                path.radiance += shadow.contribution;
+            if (!alive) break;
         }
 
-        // Background color if no object is hit.
+        //If we've exceeded the ray bounce limit, no more light is gathered.
+        return path.radiance;
+    }
+
+    bool shade(path_state& path, const hit_record& rec, int depth, const material_table& materials,
+               const light_list& lights, shadow_request& shadow) const {
+        // One bounce of a path at its hit rec: adds the emission there and moves the path on to
+        // the scattered ray. Returns false when the path ends here. Russian roulette ends some
+        // paths after roulette_depth bounces and rescales the survivors to stay unbiased.
+        // At diffuse bounces a light sample adds direct light through `shadow`, and light found
+        // by the scattered ray is weighted against it by multiple importance sampling.
+        const auto& r = path.r;
+        const auto& mat = materials[rec.mat];
+        if (mat.is_emissive()) {
+            auto weight = (path.scatter_pdf > 0) ? power_heuristic(path.scatter_pdf, lights.pdf_value(r)) : 1;
+            path.radiance += path.throughput * weight * mat.emitted(rec);
+        }
+
+        ray scattered;
+        color attenuation;
+        if (!mat.scatter(r, rec, attenuation, scattered))
+            return false;
+
+        // A path out of bounces of this kind, or of any kind, ends here without a light sample: the
+        // sample's MIS weight leaves the rest of the direct light to the scattered ray.
+        auto kind = mat.bounce(rec, scattered);
+        const int max_bounces[3] = {max_diffuse_depth, max_specular_depth, max_transmission_depth};
+        if (++path.bounces[static_cast<int>(kind)] > max_bounces[static_cast<int>(kind)] || depth + 1 >= max_depth)
+            return false;
+
+        bool sample_lights = !lights.empty() && kind == bounce_kind::diffuse;
+        color light;
+        if (sample_lights && sample_light(r, rec, mat, materials, lights, shadow.r, shadow.max_t, light)) {
+            shadow.contribution = path.throughput * light;
+            shadow.pending = true;
+        }
+
+        path.throughput = path.throughput * attenuation;
+        path.scatter_pdf = sample_lights ? mat.scattering_pdf(r, rec, scattered.direction()) : 0;
+
+        if (depth + 1 >= roulette_depth) {
+            auto survival = std::min(std::max({path.throughput.x(), path.throughput.y(), path.throughput.z()}), real(0.95));
+            if (random_double() >= survival)
+                return false;
+            path.throughput /= survival;
+        }
+
+        path.r = scattered;
+        return true;
+    }
+
+    static bool sample_light(const ray& r_in, const hit_record& rec, const material& mat, const material_table& materials,
+                             const light_list& lights, ray& shadow, real& shadow_max_t, color& light) {
+        // One light sample: the light reaching rec.p from a random light, over the density of its
+        // direction, weighted against the BSDF sampling the same direction. The caller still has
+        // to check that nothing blocks `shadow` before shadow_max_t. Returns false if there is
+        // no light to add.
+        auto direction = lights.random_direction(rec.p, r_in.time());
+        auto f = mat.evaluate(r_in, rec, direction);
+        if (f.near_zero()) return false;
+
+        // Shading data is only computed for the light; the rest of the scene answers a visibility query.
+        shadow = rec.spawn_ray(direction, r_in.time());
+        hit_record light_rec;
+        if (!lights.hit(shadow, interval(0, infinity), light_rec)) return false;
+        shadow_max_t = light_rec.t * (1 - shadow_epsilon);
+        const auto& light_mat = materials[light_rec.mat];
+
+        auto light_pdf = lights.pdf_value(shadow);
+        if (light_pdf <= 0) return false;
+        auto weight = power_heuristic(light_pdf, mat.scattering_pdf(r_in, rec, direction));
+        light = weight * f * light_mat.emitted(light_rec) / light_pdf;
+        return true;
+    }
+
+    static real power_heuristic(real pdf, real other_pdf) {
+        return pdf*pdf / (pdf*pdf + other_pdf*other_pdf);
+    }
+
+    color miss_color(const ray& r) const {
+        if (!sky) return background;
+
+        // Sky gradient seen by rays that hit nothing.
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5*(unit_direction.y() + 1.0);
         return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
@@ -0,0 +1,156 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Render checkpoints.
+   A checkpoint holds the unnormalised radiance sums of a progressive render, the sums of the
+   even-numbered samples that adaptive sampling compares them with, and the number of samples
+   each pixel has taken. The random numbers of a sample depend only on the seed, the sample
+   pattern, the pixel and the sample's index, so together with the settings in the header the
+   sample counts pin down the state of every pixel's sample stream: a resumed render takes the
+   same samples, and adds them in the same order, as one that never stopped. Adaptive sampling
+   stops whole tiles, so when adaptive the tile size, min_samples and threshold are settings too.
+
+   Layout, little-endian: magic "RTCK", version, width, height, samples_per_pixel, sample
+   pattern, adaptive flag, tile size, min_samples, size of a real, seed (u64), adaptive
+   threshold (real), then per pixel the sample counts (i32), the sums (3 reals) and the even
+   sums (3 reals), row by row from the top of the image.
+*/
+
+class render_checkpoint {
+    public:
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t samples_per_pixel = 0;
+    int32_t pattern = 0;
+    int32_t adaptive = 0;
+    int32_t tile_size = 0;
+    int32_t min_samples = 0;
+    uint64_t seed = 0;
+    real adaptive_threshold = 0;
+
+    std::vector<int32_t> counts;
+    std::vector<color> sums;
+    std::vector<color> even_sums;
+
+    render_checkpoint() {}
+
+    render_checkpoint(int width_param, int height_param)
+        : width(width_param), height(height_param), counts(size_t(width_param) * height_param),
+          sums(counts.size()), even_sums(counts.size()) {}
+
+    // Whether the settings recorded in the header match other's, so that one continues the other.
+    // Without adaptive sampling the tiles only decide which thread takes which pixels.
+    bool same_settings(const render_checkpoint& other) const {
+        bool same = width == other.width && height == other.height && samples_per_pixel == other.samples_per_pixel
+                 && pattern == other.pattern && adaptive == other.adaptive && seed == other.seed;
+        return same && (!adaptive || (tile_size == other.tile_size && min_samples == other.min_samples
+                                      && adaptive_threshold == other.adaptive_threshold));
+    }
+};
+
+const uint32_t checkpoint_magic = 0x4b435452; // "RTCK"
+const uint32_t checkpoint_version = 2;
+
+inline bool write_checkpoint(const std::string& path, const render_checkpoint& checkpoint) {
+    // Writes a temporary file and renames it over path, so an interrupted write never leaves a
+    // half-written checkpoint behind.
+    std::vector<char> out;
+    append_value(out, checkpoint_magic);
+    append_value(out, checkpoint_version);
+    append_value(out, checkpoint.width);
+    append_value(out, checkpoint.height);
+    append_value(out, checkpoint.samples_per_pixel);
+    append_value(out, checkpoint.pattern);
+    append_value(out, checkpoint.adaptive);
+    append_value(out, checkpoint.tile_size);
+    append_value(out, checkpoint.min_samples);
+    append_value<int32_t>(out, sizeof(real));
+    append_value(out, checkpoint.seed);
+    append_value(out, checkpoint.adaptive_threshold);
+    append_bytes(out, checkpoint.counts.data(), checkpoint.counts.size() * sizeof(int32_t));
+    for (const auto* buffer : {&checkpoint.sums, &checkpoint.even_sums})
+        for (const auto& c : *buffer)
+            for (int a = 0; a < 3; a++) append_value(out, c[a]);
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(out.data(), out.size());
+        if (!file.flush()) return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+inline bool read_checkpoint(const std::string& path, render_checkpoint& checkpoint) {
+    // Returns false if the file is missing, truncated, from another version or precision, or holds
+    // sample counts outside [0, samples_per_pixel].
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::vector<char> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t position = 0;
+    auto read = [&](void* value, size_t size) {
+        if (in.size() - position < size) return false;
+        std::memcpy(value, in.data() + position, size);
+        position += size;
+        return true;
+    };
+
+    uint32_t magic = 0, version = 0;
+    int32_t real_size = 0;
+    render_checkpoint header;
+    bool ok = read(&magic, 4) && read(&version, 4) && read(&header.width, 4) && read(&header.height, 4)
+           && read(&header.samples_per_pixel, 4) && read(&header.pattern, 4) && read(&header.adaptive, 4)
+           && read(&header.tile_size, 4) && read(&header.min_samples, 4) && read(&real_size, 4) && read(&header.seed, 8);
+    if (!ok || magic != checkpoint_magic || version != checkpoint_version || real_size != int32_t(sizeof(real))
+        || !read(&header.adaptive_threshold, sizeof(real)) || header.width <= 0 || header.height <= 0)
+        return false;
+
+    size_t pixels = size_t(header.width) * header.height;
+    if (in.size() - position != pixels * (sizeof(int32_t) + 6 * sizeof(real))) return false;
+
+    render_checkpoint loaded(header.width, header.height);
+    loaded.samples_per_pixel = header.samples_per_pixel;
+    loaded.pattern = header.pattern;
+    loaded.adaptive = header.adaptive;
+    loaded.tile_size = header.tile_size;
+    loaded.min_samples = header.min_samples;
+    loaded.seed = header.seed;
+    loaded.adaptive_threshold = header.adaptive_threshold;
+    read(loaded.counts.data(), pixels * sizeof(int32_t));
+    for (auto* buffer : {&loaded.sums, &loaded.even_sums}) {
+        for (auto& c : *buffer) {
+            real components[3];
+            read(components, sizeof(components));
+            c = color(components[0], components[1], components[2]);
+        }
+    }
+
+    // Every count is a valid position in its pixel's sample stream, and a pixel without samples
+    // has nothing summed, so a damaged checkpoint cannot seed or divide by nonsense.
+    for (size_t k = 0; k < pixels; k++) {
+        auto count = loaded.counts[k];
+        if (count < 0 || count > loaded.samples_per_pixel) return false;
+        if (count == 0) {
+            for (const auto* buffer : {&loaded.sums, &loaded.even_sums})
+                for (int a = 0; a < 3; a++)
+                    if ((*buffer)[k][a] != 0) return false;
+        }
+    }
+    checkpoint = std::move(loaded);
+    return true;
+}
+
+#endif
@@ -6,30 +6,14 @@
 
 using color = vec3;
 
-inline double linear_to_gamma(double linear_component){
+// Display transform of a linear component: gamma 2. framebuffer.h applies it to whole images.
+inline real linear_to_gamma(real linear_component){
     return sqrt(linear_component);
 }
-void write_color (std::ostream &out, color pixel_color, int samples_per_pixel) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
 
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r *= scale;
-    g *= scale;
-    b *= scale;
-
-    // Apply the linear to gamma transform.
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-    // Write the translated [0, 255] value of each color component.
-    static const interval intensity(0.000, 0.999);
-    out <<static_cast<int>(256 * intensity.clamp(r)) << ' '
-        <<static_cast<int>(256 * intensity.clamp(g)) << ' '
-        <<static_cast<int>(256 * intensity.clamp(b)) << '\n';
+// Relative luminance of a linear color (Rec. 709 weights).
+inline real luminance(const color& c) {
+    return real(0.2126) * c.x() + real(0.7152) * c.y() + real(0.0722) * c.z();
 }
 
 #endif
@@ -0,0 +1,253 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+#include "color.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Framebuffer and image output.
+   The renderer accumulates linear radiance into a float RGB framebuffer and writes it out once,
+   as a single binary write of the whole file. The format follows the file extension:
+     .ppm  8-bit binary PPM (P6), tone mapped to display values.
+     .pfm  Portable float map, linear 32-bit floats.
+     .exr  OpenEXR, uncompressed scanlines of linear half floats.
+   Tone mapping runs as one pass over the whole buffer, four components at a time with SSE2
+   unless RT_NO_SIMD is defined.
+*/
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(RT_NO_SIMD)
+#include <emmintrin.h>
+#define RT_FRAMEBUFFER_SSE
+#endif
+
+class framebuffer {
+    public:
+    framebuffer(int width_param, int height_param)
+        : image_width(width_param), image_height(height_param), pixels(3 * size_t(width_param) * height_param) {}
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void set(int i, int j, const color& c) {
+        auto p = &pixels[3 * (size_t(j) * image_width + i)];
+        p[0] = static_cast<float>(c.x());
+        p[1] = static_cast<float>(c.y());
+        p[2] = static_cast<float>(c.z());
+    }
+
+    color get(int i, int j) const {
+        auto p = &pixels[3 * (size_t(j) * image_width + i)];
+        return color(p[0], p[1], p[2]);
+    }
+
+    // Interleaved RGB components, row by row from the top of the image.
+    const float* data() const { return pixels.data(); }
+    size_t component_count() const { return pixels.size(); }
+
+    private:
+    int image_width;
+    int image_height;
+    std::vector<float> pixels;
+};
+
+inline void tonemap_to_bytes(const float* linear, uint8_t* out, size_t count) {
+    // Gamma 2 transform (see linear_to_gamma), clamped and quantised to [0, 255].
+    size_t i = 0;
+#ifdef RT_FRAMEBUFFER_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 top = _mm_set1_ps(0.999f);
+    const __m128 scale = _mm_set1_ps(256.0f);
+    for (; i + 4 <= count; i += 4) {
+        auto v = _mm_sqrt_ps(_mm_max_ps(_mm_loadu_ps(linear + i), zero));
+        auto levels = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(v, top), scale));
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(levels, levels), levels);
+        uint32_t bytes = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+        std::memcpy(out + i, &bytes, 4);
+    }
+#endif
+    for (; i < count; i++) {
+        auto v = std::sqrt(std::max(0.0f, linear[i])); // Argument order maps NaN to 0, like _mm_max_ps.
+        out[i] = static_cast<uint8_t>(256.0f * std::min(v, 0.999f));
+    }
+}
+
+inline uint16_t float_to_half(float value) {
+    // Round to nearest even, with overflow to infinity and gradual underflow to half denormals.
+    const uint32_t float_infinity = 255u << 23;
+    const uint32_t half_overflow = (127u + 16) << 23;
+    const uint32_t denormal_magic_bits = ((127u - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t bits;
+    std::memcpy(&bits, &value, 4);
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    uint16_t half;
+    if (bits >= half_overflow) {
+        half = (bits > float_infinity) ? 0x7e00 : 0x7c00; // NaN stays NaN, the rest is infinity.
+    } else if (bits < (113u << 23)) {
+        // Below the smallest normal half: let a float addition do the denormal rounding.
+        float magnitude, magic;
+        std::memcpy(&magnitude, &bits, 4);
+        std::memcpy(&magic, &denormal_magic_bits, 4);
+        magnitude += magic;
+        std::memcpy(&bits, &magnitude, 4);
+        half = static_cast<uint16_t>(bits - denormal_magic_bits);
+    } else {
+        uint32_t mantissa_odd = (bits >> 13) & 1;
+        bits += (uint32_t(15 - 127) << 23) + 0xfff + mantissa_odd;
+        half = static_cast<uint16_t>(bits >> 13);
+    }
+    return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+// Little-endian byte writers for the binary formats.
+inline void append_bytes(std::vector<char>& out, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+inline void append_string(std::vector<char>& out, const std::string& s) {
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+template <typename T>
+void append_value(std::vector<char>& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    append_bytes(out, bytes, sizeof(T));
+}
+
+inline std::vector<char> encode_ppm(const framebuffer& image) {
+    std::vector<char> out;
+    append_string(out, "P6\n" + std::to_string(image.width()) + ' ' + std::to_string(image.height()) + "\n255\n");
+
+    auto header_size = out.size();
+    out.resize(header_size + image.component_count());
+    tonemap_to_bytes(image.data(), reinterpret_cast<uint8_t*>(out.data() + header_size), image.component_count());
+    return out;
+}
+
+inline std::vector<char> encode_pfm(const framebuffer& image) {
+    // A negative scale marks little-endian data. Rows run from the bottom of the image up.
+    std::vector<char> out;
+    append_string(out, "PF\n" + std::to_string(image.width()) + ' ' + std::to_string(image.height()) + "\n-1.0\n");
+
+    size_t row_size = 3 * size_t(image.width()) * sizeof(float);
+    for (int j = image.height() - 1; j >= 0; j--)
+        append_bytes(out, image.data() + 3 * size_t(j) * image.width(), row_size);
+    return out;
+}
+
+inline std::vector<char> encode_exr(const framebuffer& image) {
+    // Single part scanline OpenEXR without compression: one scanline per chunk, channels stored
+    // in alphabetical order (B, G, R) as half floats.
+    int width = image.width();
+    int height = image.height();
+
+    auto attribute = [](std::vector<char>& out, const char* name, const char* type, int32_t size) {
+        append_bytes(out, name, std::strlen(name) + 1);
+        append_bytes(out, type, std::strlen(type) + 1);
+        append_value(out, size);
+    };
+
+    std::vector<char> out;
+    append_value<uint32_t>(out, 20000630); // Magic number.
+    append_value<uint32_t>(out, 2);        // Version 2, single part scanline file.
+
+    attribute(out, "channels", "chlist", 3*18 + 1);
+    for (const char* channel : {"B", "G", "R"}) {
+        append_bytes(out, channel, 2);
+        append_value<int32_t>(out, 1); // HALF
+        append_value<uint32_t>(out, 0); // pLinear and reserved bytes.
+        append_value<int32_t>(out, 1); // x sampling
+        append_value<int32_t>(out, 1); // y sampling
+    }
+    append_value<char>(out, 0);
+
+    attribute(out, "compression", "compression", 1);
+    append_value<char>(out, 0);
+
+    for (const char* window : {"dataWindow", "displayWindow"}) {
+        attribute(out, window, "box2i", 16);
+        append_value<int32_t>(out, 0);
+        append_value<int32_t>(out, 0);
+        append_value<int32_t>(out, width - 1);
+        append_value<int32_t>(out, height - 1);
+    }
+
+    attribute(out, "lineOrder", "lineOrder", 1);
+    append_value<char>(out, 0); // Increasing y.
+    attribute(out, "pixelAspectRatio", "float", 4);
+    append_value<float>(out, 1.0f);
+    attribute(out, "screenWindowCenter", "v2f", 8);
+    append_value<float>(out, 0.0f);
+    append_value<float>(out, 0.0f);
+    attribute(out, "screenWindowWidth", "float", 4);
+    append_value<float>(out, 1.0f);
+    append_value<char>(out, 0); // End of header.
+
+    // Offset table, then the scanlines it points to.
+    auto line_data_size = static_cast<int32_t>(3 * width * sizeof(uint16_t));
+    uint64_t first_line = out.size() + height * sizeof(uint64_t);
+    for (int j = 0; j < height; j++)
+        append_value<uint64_t>(out, first_line + uint64_t(j) * (8 + line_data_size));
+
+    std::vector<uint16_t> line(3 * size_t(width));
+    for (int j = 0; j < height; j++) {
+        const float* row = image.data() + 3 * size_t(j) * width;
+        for (int i = 0; i < width; i++) {
+            line[i]           = float_to_half(row[3*i + 2]);
+            line[width + i]   = float_to_half(row[3*i + 1]);
+            line[2*width + i] = float_to_half(row[3*i]);
+        }
+        append_value<int32_t>(out, j);
+        append_value<int32_t>(out, line_data_size);
+        append_bytes(out, line.data(), line_data_size);
+    }
+    return out;
+}
+
+inline bool has_extension(const std::string& path, const std::string& extension) {
+    if (path.size() < extension.size()) return false;
+    return std::equal(extension.rbegin(), extension.rend(), path.rbegin(),
+                      [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); });
+}
+
+inline bool is_image_path(const std::string& path) {
+    // Whether write_image knows the format of the path: empty, or a .ppm, .pfm or .exr file.
+    return path.empty() || has_extension(path, ".ppm") || has_extension(path, ".pfm") || has_extension(path, ".exr");
+}
+
+inline bool write_image(const std::string& path, const framebuffer& image) {
+    // Write the image in the format named by the path's extension. An empty path writes a PPM to
+    // standard output. Returns false for an unknown extension or a failed write.
+    std::vector<char> encoded;
+    if (path.empty() || has_extension(path, ".ppm"))
+        encoded = encode_ppm(image);
+    else if (has_extension(path, ".pfm"))
+        encoded = encode_pfm(image);
+    else if (has_extension(path, ".exr"))
+        encoded = encode_exr(image);
+    else
+        return false;
+
+    if (path.empty()) {
+        std::cout.write(encoded.data(), encoded.size());
+        return static_cast<bool>(std::cout.flush());
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(encoded.data(), encoded.size());
+    return static_cast<bool>(file);
+}
+
+#endif
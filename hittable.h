@@ -4,26 +4,65 @@
 #include "rtweekend.h"
 #include "aabb.h"
 
-class material;
+#include <cstdint>
+#include <type_traits>
+
+// Index of a material in the scene's material_table (material.h).
+using material_id = uint32_t;
+
+// Self-intersection policy: a secondary ray starts off the surface it leaves, pushed along the
+// normal by at least ray_offset_min and by ray_offset_relative times the largest coordinate of
+// the hit point, which keeps it clear of the intersection's rounding error in either precision.
+const real ray_offset_min = real(1e-4);
+const real ray_offset_relative = std::numeric_limits<real>::epsilon() * 512;
+
+// A shadow ray towards a surface point stops short of it by this fraction of its length, so the
+// surface itself does not count as an occluder.
+const real shadow_epsilon = real(1e-4);
+
+// Most rays traced together by one packet query (see ray_packet.h).
+const int ray_packet_size = 8;
+
+class hittable;
 
 class hit_record{
     public:
     point3 p;
-    vec3 normal;
-    shared_ptr<material> mat;
-    double t;
-    double u, v;
+    vec3 normal; // Geometric normal, on the side of the incoming ray; secondary rays offset along it.
+    vec3 shading_normal; // Normal for the BSDF, on the same side: interpolated where a mesh has vertex normals.
+    material_id mat;
+    real t;
+    real u, v;
     bool front_face;
 
+    // Which primitive was hit: the hittable that finalizes the interaction, and an index it
+    // may use to tell its own primitives apart.
+    const hittable* object;
+    uint32_t primitive;
+
+    // When object is an instance (instance.h): the hittable inside it that recorded the hit.
+    const hittable* instanced;
+
     void set_face_normal(const ray& r, const vec3& outward_normal){
         // Sets the hit record normal vector.
         // Note: the parameter 'outward normal' is assumed to have unit length.
 
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal; 
+        shading_normal = normal;
+    }
+
+    ray spawn_ray(const vec3& direction, real time) const {
+        // Ray leaving the hit point, offset to the side of the surface the direction points to.
+        auto largest = std::fmax(std::fabs(p.x()), std::fmax(std::fabs(p.y()), std::fabs(p.z())));
+        auto offset = std::fmax(ray_offset_min, ray_offset_relative * largest) * normal;
+        return ray(dot(direction, normal) > 0 ? p + offset : p - offset, direction, time);
     }
 };
 
+// Hit records are copied around the innermost intersection loops, so they must stay plain data.
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record must be trivially copyable");
+
 class hittable {
     public:
 
@@ -31,8 +70,45 @@ class hittable {
     // The ~hittable() function is the destructor function for a class. 
     // Destructors are automatically called when an object of the class is being destroyed.
     virtual ~hittable() = default;
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;\
     virtual aabb bounding_box() const = 0;
+
+    // Closest hit within ray_t, with the full surface interaction.
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        if (!intersect(r, ray_t, rec)) return false;
+        rec.object->finalize_interaction(r, rec);
+        return true;
+    }
+
+    // Closest hit within ray_t, recording only t, object, primitive and whatever local
+    // coordinates the primitive needs later. Aggregates pass the query on to their members, so
+    // a primitive that gets closer overwrites only these few fields.
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // hit() for each of up to ray_packet_size rays with the same ray_t: hits[k] tells whether
+    // rays[k] hit anything, and recs[k] is its full hit record if it did.
+    void hit_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const {
+        intersect_packet(rays, count, ray_t, recs, hits);
+        for (int k = 0; k < count; k++)
+            if (hits[k]) recs[k].object->finalize_interaction(rays[k], recs[k]);
+    }
+
+    // intersect() for each ray of a packet. Accelerators for coherent rays, such as camera rays,
+    // traverse the packet together; everything else answers ray by ray.
+    virtual void intersect_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const {
+        for (int k = 0; k < count; k++)
+            hits[k] = intersect(rays[k], ray_t, recs[k]);
+    }
+
+    // Fills in the hit point, normal, texture coordinates and material of a hit that this
+    // object's intersect() recorded, once the hit is known to be the closest.
+    virtual void finalize_interaction(const ray&, hit_record&) const {}
+
+    // Whether anything intersects r within ray_t. For visibility tests: implementations return
+    // at the first intersection they find and compute no hit_record.
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return intersect(r, ray_t, rec);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -24,22 +24,28 @@ class hittable_list : public hittable {
         bbox = aabb(bbox, object->bounding_box());
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record temp_rec;
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Objects only write to rec when they report a hit, so each closer hit can go straight
+        // into rec without a temporary copy.
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
-            if(object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)){
+            if(object->intersect(r, interval(ray_t.min, closest_so_far), rec)){
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
         return hit_anything;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects)
+            if (object->occluded(r, ray_t)) return true;
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     private:
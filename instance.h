@@ -0,0 +1,183 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "thread_pool.h"
+#include "transform.h"
+
+#include <cstdint>
+#include <vector>
+
+/* Instancing.
+   An instance places a shared object, usually a mesh or a BVH over many primitives, into the
+   scene with an affine transform. Rays move into the object's space instead of the object into
+   the scene's: the object is stored once however many instances use it. The ray direction is
+   transformed without normalising it, so hit distances mean the same in both spaces.
+
+   instance_bvh is the top level of a two-level hierarchy: a flattened BVH over instances, each
+   of which points to its own bottom-level hierarchy. Moving an instance rebuilds only this top
+   level. Instances do not nest: the object of an instance must not itself contain instances.
+*/
+
+class instance final : public hittable {
+    public:
+    instance(shared_ptr<hittable> object_param, const affine_transform& to_world_param)
+        : object(std::move(object_param)) {
+        set_transform(to_world_param);
+    }
+
+    void set_transform(const affine_transform& to_world_param) {
+        to_world = to_world_param;
+        to_object = to_world_param.inverse();
+        bbox = to_world.apply_box(object->bounding_box());
+    }
+
+    const affine_transform& transform() const { return to_world; }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!object->intersect(object_ray(r), ray_t, rec)) return false;
+
+        // Finish the interaction here, which knows how to bring it back to the scene's space.
+        rec.instanced = rec.object;
+        rec.object = this;
+        return true;
+    }
+
+    void finalize_interaction(const ray& r, hit_record& rec) const override {
+        // The object fills in the record in its own space. The normals map back by the inverse
+        // transpose, which keeps their side of the surface relative to the ray, so front_face holds.
+        rec.instanced->finalize_interaction(object_ray(r), rec);
+        rec.p = to_world.apply_point(rec.p);
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+        rec.shading_normal = unit_vector(to_object.apply_transposed(rec.shading_normal));
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(object_ray(r), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    private:
+    shared_ptr<hittable> object;
+    affine_transform to_world;
+    affine_transform to_object;
+    aabb bbox;
+
+    ray object_ray(const ray& r) const {
+        return ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    }
+};
+
+class instance_bvh : public hittable {
+    public:
+    instance_bvh(const bvh_build_options& options_param = bvh_build_options()) : options(options_param) {}
+
+    // Adds an instance of object and returns its index. Call build() before tracing rays.
+    size_t add(shared_ptr<hittable> object, const affine_transform& to_world) {
+        instances.emplace_back(std::move(object), to_world);
+        return instances.size() - 1;
+    }
+
+    // Moves instance i. Call build() before tracing rays.
+    void set_transform(size_t i, const affine_transform& to_world) { instances[i].set_transform(to_world); }
+
+    const instance& operator[](size_t i) const { return instances[i]; }
+    size_t size() const { return instances.size(); }
+
+    void build() {
+        // Rebuilds the top level over the current instance bounds; the objects are untouched.
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(instances.size(), [&](size_t i) { return instances[i].bounding_box(); }, &pool);
+
+        auto tree = linear_bvh_builder(refs, &pool).build(options);
+        nodes = std::move(tree.nodes);
+        order = std::move(tree.order);
+
+        bbox = aabb();
+        for (const auto& inst : instances)
+            bbox = aabb(bbox, inst.bounding_box());
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++) {
+                        if (instances[order[i]].intersect(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                } else {
+                    // Visit the child nearer along the split axis first, the other one later.
+                    if (r.sign(node.axis)) {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // Same traversal as intersect(), stopping at the first instance that blocks the ray.
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++)
+                        if (instances[order[i]].occluded(r, ray_t)) return true;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) return false;
+            current = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    private:
+    bvh_build_options options;
+    std::vector<instance> instances;
+    std::vector<linear_bvh_node> nodes;
+    std::vector<uint32_t> order; // Leaf offsets index this list of instance indices.
+    aabb bbox;
+};
+
+#endif
@@ -3,41 +3,44 @@
 
 #include "rtweekend.h"
 
-class interval{
+#include <algorithm>
+
+template <typename T>
+class basic_interval {
     public:
-    double min, max; 
+    T min, max;
 
-    interval() : min(+infinity), max(-infinity) {} // Default interval is empty.
-    interval(double _min, double _max) : min(_min), max(_max) {}
-    interval(const interval& a, const interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+    basic_interval() : min(+infinity), max(-infinity) {} // Default interval is empty.
+    basic_interval(T _min, T _max) : min(_min), max(_max) {}
+    basic_interval(const basic_interval& a, const basic_interval& b) : min(std::min(a.min, b.min)), max(std::max(a.max, b.max)) {}
 
-    bool contains(double x) const {
+    bool contains(T x) const {
         return min <= x && max >= x;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(T x) const {
         return min < x && max > x;
     }
 
-    double clamp(double x) const {
+    T clamp(T x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    double size() {
+    T size() const {
         return max - min;
     }
 
-    interval expand(double delta){
+    basic_interval expand(T delta) const {
         auto padding = delta/2;
-        return interval(min-padding, max+padding);
+        return basic_interval(min-padding, max+padding);
     }
-
-    static const interval empty, universe;
 };
 
+using interval = basic_interval<real>;
+
 const static interval empty(+infinity, -infinity);
 const static interval universe(-infinity, +infinity);
 
-#endif
\ No newline at end of file
+#endif
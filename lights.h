@@ -0,0 +1,67 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "rtweekend.h"
+#include "material.h"
+#include "primitive_arrays.h"
+
+/* Light sources for next-event estimation.
+   The light list holds its own copy of every sphere and quad of a scene whose material is
+   emissive. The integrator samples a direction towards one of them, picked uniformly, and asks
+   for the density of any direction under that same choice to weight light samples against
+   BSDF samples.
+*/
+
+class light_list {
+    public:
+    light_list() {}
+
+    light_list(const scene_geometry& geometry, const material_table& materials) {
+        for (size_t i = 0; i < geometry.spheres.size(); i++)
+            if (materials[geometry.spheres.mat[i]].is_emissive())
+                spheres.append(geometry.spheres, i);
+        for (size_t i = 0; i < geometry.quads.size(); i++)
+            if (materials[geometry.quads.mat[i]].is_emissive())
+                quads.append(geometry.quads, i);
+    }
+
+    size_t size() const { return spheres.size() + quads.size(); }
+    bool empty() const { return size() == 0; }
+
+    vec3 random_direction(const point3& origin, real time) const {
+        // Direction from origin towards a point on a light picked uniformly. The zero vector when
+        // the picked light cannot be seen from outside, as from inside a sphere light.
+        auto i = std::min(static_cast<size_t>(random_double() * size()), size() - 1);
+        if (i < spheres.size())
+            return spheres.random_direction(i, origin, time);
+        return quads.random_direction(i - spheres.size(), origin);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        // Nearest light hit by r within ray_t, ignoring everything else in the scene.
+        auto sphere = spheres.closest_hit(r, 0, spheres.size(), ray_t);
+        auto quad = quads.closest_hit(r, 0, quads.size(), ray_t);
+        if (quad != quads.size())
+            quads.set_hit_record(quad, r, ray_t.max, rec);
+        else if (sphere != spheres.size())
+            spheres.set_hit_record(sphere, r, ray_t.max, rec);
+        else
+            return false;
+        return true;
+    }
+
+    real pdf_value(const ray& r) const {
+        // Density of random_direction(r.origin(), r.time()) at r's direction, summed over the
+        // lights the ray meets.
+        real sum = 0;
+        for (size_t i = 0; i < spheres.size(); i++) sum += spheres.pdf_value(i, r);
+        for (size_t i = 0; i < quads.size(); i++) sum += quads.pdf_value(i, r);
+        return sum / size();
+    }
+
+    private:
+    sphere_array spheres;
+    quad_array quads;
+};
+
+#endif
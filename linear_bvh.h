@@ -0,0 +1,272 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/* Flattened BVH.
+   All nodes live in one contiguous array in depth-first order: an interior node is followed
+   directly by its first child and stores the index of its second child, a leaf stores a range
+   of the primitive array. Traversal is an explicit-stack loop with no recursion.
+*/
+
+struct linear_bvh_node {
+    float bounds_min[3]; // Single precision bounds, rounded outwards.
+    float bounds_max[3];
+    uint32_t offset;          // Leaf: first primitive. Interior: index of the second child.
+    uint16_t primitive_count; // 0 for interior nodes.
+    uint8_t axis;             // Axis separating the two children of an interior node.
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+// A flattened tree whose leaves index `order`, the input positions of the primitives in leaf
+// order. Each flattened BVH maps that order onto its own primitive storage.
+struct linear_bvh_tree {
+    std::vector<linear_bvh_node> nodes;
+    std::vector<uint32_t> order;
+};
+
+inline bool linear_bvh_node_hit(const linear_bvh_node& node, const ray& r, interval ray_t) {
+    // Same branchless slab test as aabb::hit, on the node's single precision bounds.
+    const point3& orig = r.origin();
+    const vec3& invert_dir = r.invert_direction();
+
+    for (int a = 0; a < 3; a++) {
+        real near_bound = r.sign(a) ? node.bounds_max[a] : node.bounds_min[a];
+        real far_bound = r.sign(a) ? node.bounds_min[a] : node.bounds_max[a];
+        auto t0 = (near_bound - orig[a]) * invert_dir[a];
+        auto t1 = (far_bound - orig[a]) * invert_dir[a];
+
+        ray_t.min = (t0 > ray_t.min) ? t0 : ray_t.min;
+        ray_t.max = (t1 < ray_t.max) ? t1 : ray_t.max;
+    }
+    // Widen the far distance by the rounding error of the slab distances, or rays could slip
+    // through the thin box of a flat quad far from their origin (seen in single precision).
+    return ray_t.min <= ray_t.max * (1 + 4*std::numeric_limits<real>::epsilon());
+}
+
+class linear_bvh_builder {
+    public:
+    // Deeper subtrees are split at the median, keeping the traversal stack bounded.
+    static const int max_sah_depth = 64;
+    static const int max_stack_depth = 128;
+
+    linear_bvh_builder(std::vector<bvh_build_ref>& refs_param, thread_pool* pool_param)
+        : refs(refs_param), pool(pool_param) {}
+
+    linear_bvh_tree build(const bvh_build_options& options) {
+        linear_bvh_tree tree;
+        if (refs.empty()) return tree;
+
+        tree.nodes.reserve(2 * refs.size());
+        tree.order.reserve(refs.size());
+        build(tree, 0, refs.size(), options, 0);
+        return tree;
+    }
+
+    // Single precision bounds, rounded outwards.
+    static float round_down(double x) {
+        auto f = static_cast<float>(x);
+        return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x) {
+        auto f = static_cast<float>(x);
+        return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    private:
+    std::vector<bvh_build_ref>& refs;
+    thread_pool* pool;
+
+    uint32_t build(linear_bvh_tree& out, size_t start, size_t end, bvh_build_options options, int depth) {
+        if (depth >= max_sah_depth)
+            options.method = bvh_split::median;
+
+        auto index = static_cast<uint32_t>(out.nodes.size());
+        out.nodes.push_back(linear_bvh_node());
+
+        auto mid = bvh_split_range(refs, start, end, options, pool);
+        // A leaf's primitive count has to fit its 16-bit field.
+        if (mid == end && end - start > UINT16_MAX)
+            mid = start + (end - start)/2;
+
+        aabb box;
+        if (mid == end) {
+            out.nodes[index].offset = static_cast<uint32_t>(out.order.size());
+            out.nodes[index].primitive_count = static_cast<uint16_t>(end - start);
+            for (size_t i = start; i < end; i++) {
+                out.order.push_back(static_cast<uint32_t>(refs[i].index));
+                box = aabb(box, refs[i].box);
+            }
+        } else {
+            // Order the children so that the first one lies lower along the split axis.
+            aabb left_box, right_box;
+            for (size_t i = start; i < mid; i++) left_box = aabb(left_box, refs[i].box);
+            for (size_t i = mid; i < end; i++) right_box = aabb(right_box, refs[i].box);
+
+            auto axis = split_axis(left_box, right_box);
+            if (left_box.centroid()[axis] > right_box.centroid()[axis]) {
+                std::rotate(refs.begin() + start, refs.begin() + mid, refs.begin() + end);
+                mid = start + (end - mid);
+            }
+
+            uint32_t right;
+            if (pool->size() > 1 && end - start >= bvh_parallel_task_threshold) {
+                // Build the second child into its own tree as a task, then append it behind the first.
+                linear_bvh_tree right_tree;
+                std::atomic<int> remaining(1);
+                pool->submit([&] {
+                    build(right_tree, mid, end, options, depth+1);
+                    remaining--;
+                });
+                build(out, start, mid, options, depth+1);
+                pool->wait(remaining);
+                right = append(out, right_tree);
+            } else {
+                build(out, start, mid, options, depth+1);
+                right = build(out, mid, end, options, depth+1);
+            }
+
+            out.nodes[index].offset = right;
+            out.nodes[index].axis = static_cast<uint8_t>(axis);
+            box = aabb(left_box, right_box);
+        }
+
+        for (int a = 0; a < 3; a++) {
+            out.nodes[index].bounds_min[a] = round_down(box.axis(a).min);
+            out.nodes[index].bounds_max[a] = round_up(box.axis(a).max);
+        }
+        return index;
+    }
+
+    static uint32_t append(linear_bvh_tree& out, const linear_bvh_tree& subtree) {
+        // Copy a separately built subtree to the end of `out`, rebasing its offsets.
+        auto node_base = static_cast<uint32_t>(out.nodes.size());
+        auto primitive_base = static_cast<uint32_t>(out.order.size());
+
+        for (auto node : subtree.nodes) {
+            node.offset += (node.primitive_count > 0) ? primitive_base : node_base;
+            out.nodes.push_back(node);
+        }
+        out.order.insert(out.order.end(), subtree.order.begin(), subtree.order.end());
+        return node_base;
+    }
+
+    static int split_axis(const aabb& left, const aabb& right) {
+        // The axis along which the child centres lie furthest apart decides the visiting order.
+        int axis = 0;
+        double widest = -1;
+        for (int a = 0; a < 3; a++) {
+            auto gap = std::fabs(right.centroid()[a] - left.centroid()[a]);
+            if (gap > widest) {
+                widest = gap;
+                axis = a;
+            }
+        }
+        return axis;
+    }
+};
+
+class linear_bvh : public hittable {
+    public:
+    linear_bvh(const hittable_list& list, const bvh_build_options& options = bvh_build_options()) {
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(list.objects, &pool);
+
+        auto tree = linear_bvh_builder(refs, &pool).build(options);
+        nodes = std::move(tree.nodes);
+        primitives.reserve(tree.order.size());
+        for (auto index : tree.order)
+            primitives.push_back(list.objects[index]);
+        bbox = list.bounding_box();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++) {
+                        if (primitives[i]->intersect(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                } else {
+                    // Visit the child nearer along the split axis first, the other one later.
+                    if (r.sign(node.axis)) {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // Same traversal as hit(), stopping at the first primitive that blocks the ray.
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++)
+                        if (primitives[i]->occluded(r, ray_t)) return true;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) return false;
+            current = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    private:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives; // Reordered so that every leaf is a range.
+    aabb bbox;
+};
+
+#endif
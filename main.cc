@@ -1,61 +1,22 @@
 #include "rtweekend.h"
 
-#include "bvh.h"
 #include "camera.h"
 #include "color.h"
-#include "hittable_list.h"
+#include "lights.h"
 #include "material.h"
-#include "sphere.h"
-#include "texture.h"
-#include "quad.h"
+#include "motion_bvh.h"
+#include "primitive_bvh.h"
+#include "scene_cache.h"
+#include "scenes.h"
 
+#include <chrono>
 #include <iostream>
+#include <string>
 
 void random_spheres() {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    world = hittable_list(make_shared<bvh_node>(world));
+    material_table materials;
+    // Its small spheres move, so the BVH bounds them per time segment; static scenes use the typed BVH.
+    motion_bvh world(random_spheres_scene(materials));
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0; 
@@ -71,16 +32,12 @@ void random_spheres() {
     cam.defocus_angle = 0.6;
     cam.focus_distance = 10.0;
 
-    cam.render(world);
+    cam.render(world, materials);
 }
 
 void two_spheres(){
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.8, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
+    material_table materials;
+    primitive_bvh world(two_spheres_scene(materials));
 
     camera cam;
 
@@ -96,25 +53,12 @@ void two_spheres(){
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    cam.render(world, materials);
 }
 
 void quads(){
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+    material_table materials;
+    primitive_bvh world(quads_scene(materials));
 
     camera cam;
 
@@ -130,14 +74,66 @@ void quads(){
 
     cam.defocus_angle = 0;
 
-    cam.render(world);
+    cam.render(world, materials);
+}
+
+void cornell_box(){
+    material_table materials;
+    auto geometry = cornell_box_scene(materials);
+    primitive_bvh world(geometry);
+    light_list lights(geometry, materials);
+
+    camera cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 600;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 50;
+    cam.sky = false;
+
+    cam.vertical_field_view = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.v_up = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+
+    cam.render(world, materials, lights);
 }
 
-int main() {
+bool render_scene_file(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    compiled_scene scene;
+    bool from_cache = false;
+    if (!load_scene(path, scene, from_cache)) return false;
+
+    material_table materials;
+    add_scene_materials(scene.textures, scene.materials, materials);
+    light_list lights(scene.bvh.primitives, materials);
+    // The cached tree bounds moving spheres over their whole motion: rebuild those scenes per time segment.
+    shared_ptr<hittable> world;
+    if (scene.bvh.primitives.spheres.moving())
+        world = make_shared<motion_bvh>(scene.bvh.primitives);
+    else
+        world = make_shared<primitive_bvh>(std::move(scene.bvh));
+    std::clog << (from_cache ? "Loaded the compiled scene in " : "Parsed the scene and built its BVH in ")
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s.\n";
+
+    camera cam;
+    scene.view.apply_to(cam);
+    cam.render(*world, materials, lights);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    // With a scene file, renders that; otherwise one of the scenes above.
+    if (argc > 1) return render_scene_file(argv[1]) ? 0 : 1;
+
     switch (3)
     {
     case 1: random_spheres(); break;
     case 2: two_spheres(); break;
     case 3: quads(); break;
+    case 4: cornell_box(); break;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,73 @@
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Microbenchmark of ray/box tests per second: the original per-axis test, which divides and
+// swaps per axis on copies of the ray vectors, against aabb::hit on the ray's cached reciprocal.
+
+using bench_clock = std::chrono::steady_clock;
+
+bool legacy_box_hit(const aabb& box, const ray& r, interval ray_t) {
+    point3 origin = r.origin();
+    vec3 direction = r.direction();
+    for (int a = 0; a < 3; a++) {
+        auto invert_dir = 1/direction[a];
+        auto orig = origin[a];
+
+        auto t0 = (box.axis(a).min - orig) * invert_dir;
+        auto t1 = (box.axis(a).max - orig) * invert_dir;
+        if (invert_dir < 0) std::swap(t0, t1);
+
+        if (t0 > ray_t.min) ray_t.min = t0;
+        if (t1 < ray_t.max) ray_t.max = t1;
+
+        if (ray_t.max <= ray_t.min) return false;
+    }
+    return true;
+}
+
+template <typename Test>
+void run(const char* name, const std::vector<aabb>& boxes, const std::vector<ray>& rays, Test test) {
+    const int rounds = 8;
+    long hits = 0;
+
+    auto start = bench_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (const auto& r : rays)
+            for (const auto& box : boxes)
+                hits += test(box, r, interval(0.001, infinity));
+    auto elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    double tests = static_cast<double>(rounds) * rays.size() * boxes.size();
+    std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << tests / elapsed / 1e6 << " Mtests/sec"
+              << std::setw(12) << hits / rounds << " hits\n";
+}
+
+int main() {
+    // Boxes scattered around the origin, and rays from all directions through the same region.
+    std::vector<aabb> boxes;
+    for (int i = 0; i < 1024; i++) {
+        auto corner = point3::random(-10, 10);
+        boxes.push_back(aabb(corner, corner + vec3::random(0.1, 2)));
+    }
+
+    std::vector<ray> rays;
+    for (int i = 0; i < 2048; i++) {
+        auto origin = point3::random(-20, 20);
+        auto direction = point3::random(-5, 5) - origin;
+        // Some axis-aligned rays exercise the zero direction components.
+        if (i % 16 == 0) direction[i % 3] = 0;
+        rays.push_back(ray(origin, direction));
+    }
+
+    run("legacy aabb test", boxes, rays, legacy_box_hit);
+    run("aabb::hit", boxes, rays, [](const aabb& box, const ray& r, interval ray_t) {
+        return box.hit(r, ray_t);
+    });
+}
@@ -0,0 +1,73 @@
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Startup-time benchmark: BVH build time against primitive count and build thread count.
+// Usage: main_bvh_build_bench [largest primitive count]
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+hittable_list random_sphere_cloud(size_t count) {
+    // Small spheres scattered through a cube, a quarter of them moving.
+    hittable_list world;
+    world.objects.reserve(count);
+    material_id mat = 0;
+    auto side = std::cbrt(static_cast<double>(count));
+
+    for (size_t i = 0; i < count; i++) {
+        auto center = point3::random(-side, side);
+        if (i % 4 == 0)
+            world.add(make_shared<sphere>(center, center + vec3(0, 0.5, 0), 0.2, mat));
+        else
+            world.add(make_shared<sphere>(center, 0.2, mat));
+    }
+    return world;
+}
+
+int main(int argc, char** argv) {
+    size_t largest = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    std::vector<int> thread_counts = {1, 2, 4};
+    int hardware_threads = static_cast<int>(std::thread::hardware_concurrency());
+    if (hardware_threads > 4) thread_counts.push_back(hardware_threads);
+
+    std::cout << "primitives  threads  bvh_node (ms)  linear_bvh (ms)     nodes\n";
+
+    for (size_t count = 10000; count <= largest; count *= 10) {
+        auto world = random_sphere_cloud(count);
+
+        for (int threads : thread_counts) {
+            bvh_build_options options;
+            options.thread_count = threads;
+
+            auto start = bench_clock::now();
+            bvh_node tree(world, options);
+            auto node_time = seconds_since(start);
+
+            start = bench_clock::now();
+            linear_bvh flat(world, options);
+            auto linear_time = seconds_since(start);
+
+            std::cout << std::setw(10) << count << std::setw(9) << threads
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(15) << node_time * 1000
+                      << std::setw(17) << linear_time * 1000
+                      << std::setw(10) << flat.node_count() << '\n';
+        }
+    }
+}
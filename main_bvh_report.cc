@@ -0,0 +1,131 @@
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "motion_bvh.h"
+#include "primitive_bvh.h"
+#include "wide_bvh.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compares BVH builders on the random_spheres scene: build time, tree shape, SAH cost and the
+// closest-hit query rate for a fixed set of rays.
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+double trace(const hittable& bvh, const std::vector<ray>& rays, int& hits) {
+    // Time closest-hit queries for every ray, returning the elapsed seconds.
+    auto start = bench_clock::now();
+    hits = 0;
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (bvh.hit(r, interval(0.001, infinity), rec)) hits++;
+    }
+    return seconds_since(start);
+}
+
+void report(const char* name, const hittable_list& world, const std::vector<ray>& rays,
+            const bvh_build_options& options) {
+    auto start = bench_clock::now();
+    bvh_node bvh(world, options);
+    auto build_time = seconds_since(start);
+
+    int hits;
+    auto trace_time = trace(bvh, rays, hits);
+
+    auto stats = bvh.stats();
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::setw(8) << stats.node_count
+              << std::setw(8) << stats.leaf_count
+              << std::setw(7) << stats.max_depth
+              << std::setw(10) << stats.max_leaf_size
+              << std::setw(11) << std::fixed << std::setprecision(4) << stats.sah_cost
+              << std::setw(12) << std::setprecision(3) << build_time * 1000
+              << std::setw(13) << std::setprecision(2) << rays.size() / trace_time / 1e6
+              << std::setw(9) << hits << '\n';
+}
+
+template <typename Bvh, typename Source>
+void report_flattened(const std::string& name, const Source& source, const std::vector<ray>& rays,
+                      const bvh_build_options& options) {
+    auto start = bench_clock::now();
+    Bvh bvh(source, options);
+    auto build_time = seconds_since(start);
+
+    int hits;
+    auto trace_time = trace(bvh, rays, hits);
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::setw(8) << bvh.node_count() << std::setw(36) << ' '
+              << std::setw(12) << std::setprecision(3) << build_time * 1000
+              << std::setw(13) << std::setprecision(2) << rays.size() / trace_time / 1e6
+              << std::setw(9) << hits << '\n';
+}
+
+int main() {
+    material_table materials;
+    scene_geometry geometry = random_spheres_scene(materials);
+    hittable_list world = geometry.to_hittable_list();
+
+    // Rays from the random_spheres camera position towards random points across the sphere field.
+    std::vector<ray> rays;
+    for (int i = 0; i < 500000; i++) {
+        point3 origin(13, 2, 3);
+        point3 target(random_double(-11, 11), random_double(0, 1), random_double(-11, 11));
+        rays.push_back(ray(origin, target - origin, random_double()));
+    }
+
+    std::cout << world.objects.size() << " primitives, " << rays.size() << " rays\n";
+    std::cout << "scalar " << (sizeof(real) == 4 ? "float" : "double")
+              << ": vec3 " << sizeof(vec3) << " B, ray " << sizeof(ray) << " B, aabb " << sizeof(aabb)
+              << " B, hit_record " << sizeof(hit_record) << " B, sphere " << sizeof(sphere) << " B\n\n";
+    std::cout << "builder            nodes  leaves  depth  max leaf   SAH cost  build (ms)  Mrays/sec     hits\n";
+
+    bvh_build_options median;
+    median.method = bvh_split::median;
+    median.max_leaf_size = 1;
+    report("median, leaf 1", world, rays, median);
+
+    bvh_build_options sah;
+    for (int leaf_size : {1, 2, 4, 8}) {
+        sah.max_leaf_size = leaf_size;
+        std::string name = "sah, leaf " + std::to_string(leaf_size);
+        report(name.c_str(), world, rays, sah);
+    }
+
+    std::cout << "\nflattened         nodes                                    build (ms)  Mrays/sec     hits\n";
+    for (int leaf_size : {1, 4}) {
+        sah.max_leaf_size = leaf_size;
+        report_flattened<linear_bvh>("linear, leaf " + std::to_string(leaf_size), world, rays, sah);
+    }
+    for (int leaf_size : {1, 4}) {
+        sah.max_leaf_size = leaf_size;
+        report_flattened<primitive_bvh>("typed, leaf " + std::to_string(leaf_size), geometry, rays, sah);
+    }
+    for (int leaf_size : {1, 4}) {
+        sah.max_leaf_size = leaf_size;
+        report_flattened<wide_bvh>("wide" + std::to_string(wide_bvh_width) + ", leaf " + std::to_string(leaf_size), world, rays, sah);
+    }
+    for (int leaf_size : {1, 4}) {
+        sah.max_leaf_size = leaf_size;
+        report_flattened<motion_bvh>("motion, leaf " + std::to_string(leaf_size), geometry, rays, sah);
+    }
+
+    // The same spheres held still at their time 0 positions: the speed a motion BVH aims for.
+    scene_geometry still = geometry;
+    for (auto* motion : {&still.spheres.motion.x, &still.spheres.motion.y, &still.spheres.motion.z})
+        std::fill(motion->begin(), motion->end(), real(0));
+    sah.max_leaf_size = 4;
+    report_flattened<primitive_bvh>("still typed, 4", still, rays, sah);
+}
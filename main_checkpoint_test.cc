@@ -0,0 +1,108 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "checkpoint.h"
+#include "material.h"
+#include "primitive_bvh.h"
+#include "scenes.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+// Progressive renders that stop after their first pass and resume with another tile size. A
+// resumed render has to leave the same checkpoint, sums and counts bit for bit, as one that never
+// stopped; an adaptive one, whose tiles decide where sampling stops, has to refuse to resume.
+// Checkpoints with sample counts out of range have to be refused on reading.
+// Usage: main_checkpoint_test
+
+camera test_camera(bool adaptive, int tile_size, const std::string& checkpoint_file) {
+    camera cam;
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 48;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 8;
+    cam.vertical_field_view = 80;
+    cam.lookfrom = point3(0, 0, 9);
+    cam.lookat = point3(0, 0, 0);
+    cam.v_up = vec3(0, 1, 0);
+
+    cam.tile_size = tile_size;
+    cam.adaptive = adaptive;
+    cam.min_samples = 4;
+    cam.adaptive_threshold = 0.05;
+    cam.progressive = true;
+    cam.pass_samples = 4;
+    cam.checkpoint_file = checkpoint_file;
+    cam.output_file = checkpoint_file + ".pfm";
+    return cam;
+}
+
+bool same_checkpoints(const std::string& a_path, const std::string& b_path) {
+    render_checkpoint a, b;
+    if (!read_checkpoint(a_path, a) || !read_checkpoint(b_path, b)) return false;
+    if (a.counts != b.counts) return false;
+    for (size_t k = 0; k < a.sums.size(); k++)
+        for (int c = 0; c < 3; c++)
+            if (a.sums[k][c] != b.sums[k][c] || a.even_sums[k][c] != b.even_sums[k][c]) return false;
+    return true;
+}
+
+int check(const char* name, bool passed) {
+    std::cout << name << ": " << (passed ? "ok" : "FAILED") << '\n';
+    return passed ? 0 : 1;
+}
+
+int main() {
+    material_table materials;
+    primitive_bvh world(quads_scene(materials));
+    const std::string whole = "checkpoint_test_whole.rtck", resumed = "checkpoint_test_resumed.rtck";
+    int failures = 0;
+
+    // Without adaptive sampling: the first pass in tiles of 16, the rest in tiles of 7.
+    test_camera(false, 16, whole).render(world, materials);
+    auto first = test_camera(false, 16, resumed);
+    first.max_passes = 1;
+    first.render(world, materials);
+    auto rest = test_camera(false, 7, resumed);
+    rest.resume = true;
+    rest.render(world, materials);
+    failures += check("resume with another tile size", same_checkpoints(whole, resumed));
+
+    // Adaptive: the same settings resume, another tile size is refused and leaves the checkpoint.
+    test_camera(true, 16, whole).render(world, materials);
+    first = test_camera(true, 16, resumed);
+    first.max_passes = 1;
+    first.render(world, materials);
+    render_checkpoint after_first;
+    if (!read_checkpoint(resumed, after_first) || !write_checkpoint(resumed + ".first", after_first)) return 1;
+
+    auto refused = test_camera(true, 7, resumed);
+    refused.resume = true;
+    refused.render(world, materials);
+    failures += check("adaptive resume with another tile size refused", same_checkpoints(resumed + ".first", resumed));
+
+    rest = test_camera(true, 16, resumed);
+    rest.resume = true;
+    rest.render(world, materials);
+    failures += check("adaptive resume", same_checkpoints(whole, resumed));
+
+    // Damaged counts: each of these has to be rejected when read back.
+    render_checkpoint finished;
+    if (!read_checkpoint(whole, finished)) return 1;
+    const std::string damaged = "checkpoint_test_damaged.rtck";
+    for (int damage = 0; damage < 3; damage++) {
+        auto copy = finished;
+        if (damage == 0) copy.counts[5] = -1;
+        if (damage == 1) copy.counts[5] = copy.samples_per_pixel + 1;
+        if (damage == 2) copy.counts[5] = 0;
+        render_checkpoint read_back;
+        bool rejected = write_checkpoint(damaged, copy) && !read_checkpoint(damaged, read_back);
+        failures += check(damage == 0 ? "negative count rejected" : damage == 1 ? "count above samples_per_pixel rejected"
+                                                                                : "zero count with sums rejected", rejected);
+    }
+
+    for (const auto& path : {damaged, whole, resumed, resumed + ".first", whole + ".pfm", resumed + ".pfm"})
+        std::remove(path.c_str());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "quad.h"
+#include "transform.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Two-level hierarchy: a forest of instances of one tree mesh. Reports the memory of the shared
+// mesh against a flattened copy of the forest, the top-level build time, the cost of moving one
+// instance, and the closest-hit rate. A small forest is also flattened into a single mesh, whose
+// hits the instanced version has to match. With an image path, also renders the forest.
+// Usage: main_instance_bench [instance count] [image path]
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+mesh_data tree_mesh(int segments) {
+    // A cone for the crown over a thin cylinder for the trunk, both closed, standing on y = 0.
+    mesh_data mesh;
+    auto ring = [&](real radius, real height) {
+        auto first = static_cast<uint32_t>(mesh.positions.size());
+        for (int k = 0; k < segments; k++) {
+            auto phi = 2 * pi * k / segments;
+            mesh.positions.push_back(point3(radius*std::cos(phi), height, radius*std::sin(phi)));
+        }
+        return first;
+    };
+    auto point = [&](const point3& p) {
+        mesh.positions.push_back(p);
+        return static_cast<uint32_t>(mesh.positions.size() - 1);
+    };
+    auto fan = [&](uint32_t center, uint32_t first) {
+        for (int k = 0; k < segments; k++)
+            mesh.position_indices.insert(mesh.position_indices.end(), {center, first + k, first + (k + 1) % segments});
+    };
+
+    auto trunk_bottom = ring(0.1, 0), trunk_top = ring(0.1, 0.5);
+    fan(point(point3(0, 0, 0)), trunk_bottom);
+    for (int k = 0; k < segments; k++) {
+        uint32_t a = trunk_bottom + k, b = trunk_bottom + (k + 1) % segments;
+        uint32_t c = trunk_top + k, d = trunk_top + (k + 1) % segments;
+        mesh.position_indices.insert(mesh.position_indices.end(), {a, b, c, b, d, c});
+    }
+
+    // The crown in bands, so that the mesh has a realistic triangle count.
+    const int bands = 8;
+    uint32_t previous = ring(0.6, 0.5);
+    fan(point(point3(0, 0.5, 0)), previous);
+    for (int band = 1; band < bands; band++) {
+        real t = real(band) / bands;
+        auto current = ring(0.6 * (1 - t), 0.5 + 1.5 * t);
+        for (int k = 0; k < segments; k++) {
+            uint32_t a = previous + k, b = previous + (k + 1) % segments;
+            uint32_t c = current + k, d = current + (k + 1) % segments;
+            mesh.position_indices.insert(mesh.position_indices.end(), {a, b, c, b, d, c});
+        }
+        previous = current;
+    }
+    fan(point(point3(0, 2, 0)), previous);
+    return mesh;
+}
+
+size_t mesh_bytes(const mesh_data& mesh) {
+    return mesh.positions.size() * sizeof(point3) + mesh.position_indices.size() * sizeof(uint32_t);
+}
+
+affine_transform random_placement(real extent) {
+    auto position = vec3(random_double(-extent, extent), 0, random_double(-extent, extent));
+    auto scale = random_double(0.7, 1.3);
+    return affine_transform::translation(position) * affine_transform::rotation(vec3(0,1,0), random_double(0, 360))
+         * affine_transform::scaling(vec3(scale, scale, scale));
+}
+
+std::vector<ray> forest_rays(int count, real extent) {
+    // From above the forest, down through it at varied angles.
+    std::vector<ray> rays;
+    for (int i = 0; i < count; i++) {
+        point3 origin(random_double(-extent, extent), 10, random_double(-extent, extent));
+        point3 target(random_double(-extent, extent), 0, random_double(-extent, extent));
+        rays.push_back(ray(origin, target - origin, 0));
+    }
+    return rays;
+}
+
+bool check_against_flattened() {
+    // Forty instances against one mesh holding forty transformed copies of the tree.
+    auto tree = tree_mesh(24);
+    auto blas = make_shared<triangle_mesh>(tree, 0);
+    instance_bvh forest;
+    mesh_data flattened;
+    for (int i = 0; i < 40; i++) {
+        auto placement = random_placement(5);
+        forest.add(blas, placement);
+        auto base = static_cast<uint32_t>(flattened.positions.size());
+        for (const auto& p : tree.positions) flattened.positions.push_back(placement.apply_point(p));
+        for (auto index : tree.position_indices) flattened.position_indices.push_back(base + index);
+    }
+    forest.build();
+    triangle_mesh reference(std::move(flattened), 0);
+
+    int mismatches = 0;
+    for (const auto& r : forest_rays(100000, 5)) {
+        hit_record a, b;
+        bool hit_a = forest.hit(r, interval(0, infinity), a);
+        bool hit_b = reference.hit(r, interval(0, infinity), b);
+        // Rounding differs between the two, so a grazing ray may hit in one and miss in the other.
+        if (hit_a != hit_b || (hit_a && ((a.p - b.p).length() > 1e-3 || dot(a.normal, b.normal) < 0.999
+                                         || a.front_face != b.front_face)))
+            mismatches++;
+    }
+    std::cout << "instanced vs flattened: " << mismatches << " of 100000 rays differ\n";
+    return mismatches < 10;
+}
+
+int main(int argc, char** argv) {
+    int instance_count = (argc > 1) ? std::atoi(argv[1]) : 100000;
+    real extent = std::sqrt(real(instance_count));
+
+    bool ok = check_against_flattened();
+
+    auto tree = tree_mesh(64);
+    auto blas_bytes = mesh_bytes(tree);
+    auto triangles = tree.triangle_count();
+    auto blas = make_shared<triangle_mesh>(std::move(tree), 0);
+
+    instance_bvh forest;
+    for (int i = 0; i < instance_count; i++)
+        forest.add(blas, random_placement(extent));
+
+    auto start = bench_clock::now();
+    forest.build();
+    auto build_seconds = seconds_since(start);
+
+    start = bench_clock::now();
+    forest.set_transform(0, random_placement(extent));
+    forest.build();
+    auto move_seconds = seconds_since(start);
+
+    std::cout << std::fixed << std::setprecision(3)
+              << instance_count << " instances of a " << triangles << " triangle tree\n"
+              << "shared mesh       " << blas_bytes / 1e6 << " MB\n"
+              << "instances         " << instance_count * sizeof(instance) / 1e6 << " MB\n"
+              << "flattened forest  " << double(blas_bytes) * instance_count / 1e6 << " MB\n"
+              << "top-level build   " << build_seconds << " s, " << forest.node_count() << " nodes\n"
+              << "move one, rebuild " << move_seconds << " s\n";
+
+    auto rays = forest_rays(1000000, extent);
+    size_t hits = 0;
+    start = bench_clock::now();
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (forest.hit(r, interval(0, infinity), rec)) hits++;
+    }
+    std::cout << "closest hit       " << rays.size() / seconds_since(start) / 1e6 << " Mrays/s, "
+              << hits << " hits\n";
+
+    if (argc > 2) {
+        material_table materials;
+        auto green = materials.add(make_shared<lambertian>(color(0.2, 0.45, 0.15)));
+        auto ground = materials.add(make_shared<lambertian>(color(0.5, 0.4, 0.3)));
+        instance_bvh scene;
+        auto coloured = make_shared<triangle_mesh>(tree_mesh(64), green);
+        for (int i = 0; i < instance_count; i++)
+            scene.add(coloured, forest[i].transform());
+        scene.build();
+
+        hittable_list world;
+        world.add(make_shared<instance_bvh>(std::move(scene)));
+        world.add(make_shared<quad>(point3(-extent, 0, -extent), vec3(2*extent, 0, 0), vec3(0, 0, 2*extent), ground));
+
+        camera cam;
+        cam.image_width = 600;
+        cam.samples_per_pixel = 16;
+        cam.max_depth = 10;
+        cam.vertical_field_view = 40;
+        cam.lookfrom = point3(0, 8, extent + 10);
+        cam.lookat = point3(0, 0, extent - 20);
+        cam.output_file = argv[2];
+        cam.render(world, materials);
+    }
+    return ok ? 0 : 1;
+}
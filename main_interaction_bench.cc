@@ -0,0 +1,86 @@
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "primitive_bvh.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Closest-hit query rate, with the full surface interaction of every hit, on dense scenes where
+// a ray passes through many overlapping primitives before its nearest hit is known.
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+scene_geometry dense_scene(int sphere_count, int quad_count) {
+    // Overlapping spheres and quads packed into a 20-unit cube.
+    scene_geometry world;
+    for (int i = 0; i < sphere_count; i++) {
+        point3 center(random_double(-10, 10), random_double(-10, 10), random_double(-10, 10));
+        world.spheres.add(center, random_double(0.2, 0.8), 0);
+    }
+    for (int i = 0; i < quad_count; i++) {
+        point3 corner(random_double(-10, 10), random_double(-10, 10), random_double(-10, 10));
+        world.quads.add(corner, vec3::random(-1, 1), vec3::random(-1, 1), 0);
+    }
+    return world;
+}
+
+double trace(const hittable& world, const std::vector<ray>& rays, real& checksum) {
+    // Time closest-hit queries for every ray, returning the elapsed seconds. The checksum reads
+    // the shading fields so that none of them can be skipped.
+    auto start = bench_clock::now();
+    checksum = 0;
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (world.hit(r, interval(0, infinity), rec))
+            checksum += rec.t + rec.u + rec.v + rec.normal.x() + rec.p.y();
+    }
+    return seconds_since(start);
+}
+
+void report(const std::string& name, const hittable& world, const std::vector<ray>& rays) {
+    // Best of five runs, to keep other load on the machine out of the figures.
+    real checksum;
+    auto trace_time = trace(world, rays, checksum);
+    for (int run = 1; run < 5; run++)
+        trace_time = std::min(trace_time, trace(world, rays, checksum));
+    std::cout << std::left << std::setw(18) << name << std::right
+              << std::setw(11) << std::fixed << std::setprecision(2) << rays.size() / trace_time / 1e6
+              << std::setw(16) << std::setprecision(3) << checksum << '\n';
+}
+
+int main() {
+    for (auto counts : {std::make_pair(2000, 0), std::make_pair(50000, 0), std::make_pair(25000, 25000)}) {
+        auto geometry = dense_scene(counts.first, counts.second);
+        auto list = geometry.to_hittable_list();
+
+        // Rays from outside the cube through random points inside it.
+        std::vector<ray> rays;
+        for (int i = 0; i < 200000; i++) {
+            point3 origin = 30 * random_unit_vector();
+            point3 target(random_double(-10, 10), random_double(-10, 10), random_double(-10, 10));
+            rays.push_back(ray(origin, target - origin, random_double()));
+        }
+
+        std::cout << counts.first << " spheres, " << counts.second << " quads, " << rays.size() << " rays\n";
+        std::cout << "hierarchy           Mrays/sec        checksum\n";
+        bvh_build_options options;
+        options.max_leaf_size = 4;
+        report("bvh_node, leaf 4", bvh_node(list, options), rays);
+        report("linear, leaf 4", linear_bvh(list, options), rays);
+        report("wide, leaf 4", wide_bvh(list, options), rays);
+        report("typed, leaf 4", primitive_bvh(geometry, options), rays);
+        std::cout << '\n';
+    }
+}
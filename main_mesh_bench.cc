@@ -0,0 +1,160 @@
+#include "rtweekend.h"
+
+#include "mesh_loader.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Mesh loading and tracing: a tessellated sphere is written as OBJ and as .rtmesh, loaded back
+// from both, and traced from the inside. Rays aimed exactly at its vertices and edge midpoints
+// check that the triangle test leaves no cracks; every one of them has to hit.
+// Usage: main_mesh_bench [triangle count] [directory for the mesh files]
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+mesh_data sphere_mesh(int rings, int segments) {
+    // Latitude-longitude tessellation of the unit sphere with shared vertices, including one
+    // vertex per pole, so the mesh is closed.
+    mesh_data mesh;
+    mesh.positions.push_back(point3(0, 1, 0));
+    for (int ring = 1; ring < rings; ring++) {
+        auto theta = pi * ring / rings;
+        for (int segment = 0; segment < segments; segment++) {
+            auto phi = 2 * pi * segment / segments;
+            mesh.positions.push_back(point3(std::sin(theta)*std::cos(phi), std::cos(theta), std::sin(theta)*std::sin(phi)));
+        }
+    }
+    mesh.positions.push_back(point3(0, -1, 0));
+    mesh.normals = mesh.positions;
+    for (const auto& p : mesh.positions) {
+        mesh.uvs.push_back(std::atan2(p.z(), p.x()) / (2*pi) + 0.5);
+        mesh.uvs.push_back(std::acos(p.y()) / pi);
+    }
+
+    auto vertex = [&](int ring, int segment) {
+        // Ring 0 and ring `rings` are the poles.
+        if (ring == 0) return uint32_t(0);
+        if (ring == rings) return uint32_t(mesh.positions.size() - 1);
+        return uint32_t(1 + (ring - 1) * segments + segment % segments);
+    };
+    auto triangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+        for (auto* indices : {&mesh.position_indices, &mesh.normal_indices, &mesh.uv_indices})
+            indices->insert(indices->end(), {a, b, c});
+    };
+    for (int ring = 0; ring < rings; ring++) {
+        for (int segment = 0; segment < segments; segment++) {
+            auto a = vertex(ring, segment), b = vertex(ring, segment + 1);
+            auto c = vertex(ring + 1, segment), d = vertex(ring + 1, segment + 1);
+            if (ring > 0) triangle(a, b, c);
+            if (ring < rings - 1) triangle(b, d, c);
+        }
+    }
+    return mesh;
+}
+
+bool write_obj(const std::string& path, const mesh_data& mesh) {
+    std::ofstream file(path);
+    char line[128];
+    for (const auto& p : mesh.positions) {
+        std::snprintf(line, sizeof(line), "v %.9g %.9g %.9g\n", double(p.x()), double(p.y()), double(p.z()));
+        file << line;
+    }
+    for (const auto& n : mesh.normals) {
+        std::snprintf(line, sizeof(line), "vn %.9g %.9g %.9g\n", double(n.x()), double(n.y()), double(n.z()));
+        file << line;
+    }
+    for (size_t i = 0; i < mesh.uvs.size(); i += 2) {
+        std::snprintf(line, sizeof(line), "vt %.9g %.9g\n", double(mesh.uvs[i]), double(mesh.uvs[i + 1]));
+        file << line;
+    }
+    for (size_t i = 0; i < mesh.position_indices.size(); i += 3) {
+        file << 'f';
+        for (int corner = 0; corner < 3; corner++) {
+            file << ' ' << mesh.position_indices[i + corner] + 1 << '/' << mesh.uv_indices[i + corner] + 1
+                 << '/' << mesh.normal_indices[i + corner] + 1;
+        }
+        file << '\n';
+    }
+    return static_cast<bool>(file);
+}
+
+bool same_mesh(const mesh_data& a, const mesh_data& b) {
+    return a.positions.size() == b.positions.size() && a.normals.size() == b.normals.size()
+        && a.uvs == b.uvs && a.position_indices == b.position_indices
+        && a.normal_indices == b.normal_indices && a.uv_indices == b.uv_indices
+        && std::equal(a.positions.begin(), a.positions.end(), b.positions.begin(),
+                      [](const point3& p, const point3& q) { return p.x() == q.x() && p.y() == q.y() && p.z() == q.z(); });
+}
+
+int main(int argc, char** argv) {
+    long triangle_target = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    std::string directory = (argc > 2) ? argv[2] : ".";
+    int segments = std::max(8, static_cast<int>(std::sqrt(triangle_target)));
+    int rings = std::max(4, static_cast<int>(triangle_target / (2 * segments)));
+
+    auto generated = sphere_mesh(rings, segments);
+    auto obj_path = directory + "/mesh_bench.obj";
+    auto binary_path = directory + "/mesh_bench.rtmesh";
+    if (!write_obj(obj_path, generated)) {
+        std::cerr << "Could not write " << obj_path << '\n';
+        return 1;
+    }
+
+    std::cout << generated.triangle_count() << " triangles, " << generated.positions.size() << " vertices\n";
+
+    mesh_data from_obj, from_binary;
+    auto start = bench_clock::now();
+    if (!load_obj(obj_path, from_obj)) return 1;
+    auto obj_seconds = seconds_since(start);
+
+    if (!write_binary_mesh(binary_path, from_obj)) {
+        std::cerr << "Could not write " << binary_path << '\n';
+        return 1;
+    }
+    start = bench_clock::now();
+    if (!load_binary_mesh(binary_path, from_binary)) return 1;
+    auto binary_seconds = seconds_since(start);
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "OBJ load          " << obj_seconds << " s\n"
+              << "binary load       " << binary_seconds << " s\n"
+              << "loads agree       " << (same_mesh(from_obj, from_binary) ? "yes" : "NO") << '\n';
+
+    start = bench_clock::now();
+    triangle_mesh mesh(std::move(from_binary), 0);
+    std::cout << "BVH build         " << seconds_since(start) << " s, " << mesh.node_count() << " nodes\n";
+
+    // From the centre towards every vertex and edge midpoint: exactly on shared edges.
+    std::vector<ray> rays;
+    const auto& p = generated.positions;
+    const auto& indices = generated.position_indices;
+    for (size_t i = 0; i < indices.size() && rays.size() < 2000000; i += 3) {
+        rays.push_back(ray(point3(0,0,0), p[indices[i]], 0));
+        rays.push_back(ray(point3(0,0,0), 0.5 * (p[indices[i]] + p[indices[i + 1]]), 0));
+    }
+    // And from random points inside in random directions.
+    for (int i = 0; i < 1000000; i++)
+        rays.push_back(ray(0.5 * random_in_unit_sphere(), random_unit_vector(), 0));
+
+    size_t misses = 0;
+    start = bench_clock::now();
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (!mesh.hit(r, interval(0, infinity), rec)) misses++;
+    }
+    auto trace_seconds = seconds_since(start);
+    std::cout << "closest hit       " << rays.size() / trace_seconds / 1e6 << " Mrays/s\n"
+              << "misses            " << misses << " of " << rays.size() << '\n';
+    return misses == 0 ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include "rtweekend.h"
+
+#include "material.h"
+#include "motion_bvh.h"
+#include "primitive_bvh.h"
+#include "scenes.h"
+
+#include <iostream>
+#include <vector>
+
+// Packet traversal against single rays on near-edge rays. The packet slab test repeats
+// linear_bvh_node_hit lane by lane, in real and with the same widening, so no ray may find
+// anything in a packet that it does not find alone. A slab test that differed would show first
+// on rays that graze a box with the closest hit lying right there, so the packets are aimed at
+// exactly such points: the edges and corners of quads, which are faces of their leaf boxes, and
+// the silhouettes of spheres. Every lane of every packet has to report the same hit, primitive
+// and distance as the ray traced alone. The motion BVH splits packets by time segment, so its
+// rays spread their times over the shutter interval and must land back in their own lanes.
+// Usage: main_packet_test
+
+int compare(const char* name, const primitive_bvh& bvh, const std::vector<ray>& rays) {
+    int mismatches = 0;
+    for (size_t start = 0; start < rays.size(); start += ray_packet_size) {
+        int count = static_cast<int>(std::min<size_t>(ray_packet_size, rays.size() - start));
+        hit_record recs[ray_packet_size];
+        bool hits[ray_packet_size];
+        bvh.intersect_packet(&rays[start], count, interval(0.001, infinity), recs, hits);
+
+        for (int k = 0; k < count; k++) {
+            hit_record rec;
+            bool hit = bvh.intersect(rays[start + k], interval(0.001, infinity), rec);
+            if (hit != hits[k] || (hit && (rec.primitive != recs[k].primitive || rec.t != recs[k].t)))
+                mismatches++;
+        }
+    }
+    std::cout << name << ": " << mismatches << " of " << rays.size() << " rays differ\n";
+    return mismatches;
+}
+
+void add_packet(std::vector<ray>& rays, const point3& origin, const point3& target, const vec3& step) {
+    // Eight rays from one origin to points spaced by step around target, a few of them nudged to
+    // either side by a relative 1e-7.
+    for (int k = 0; k < ray_packet_size; k++) {
+        auto point = target + (k - ray_packet_size / 2) * step;
+        if (k % 3 == 1) point = point * (1 + 1e-7);
+        if (k % 3 == 2) point = point * (1 - 1e-7);
+        rays.push_back(ray(origin, point - origin, 0));
+    }
+}
+
+std::vector<ray> quad_edge_rays(const scene_geometry& geometry, const point3& eye) {
+    // Packets along each edge of every quad, and at each corner.
+    std::vector<ray> rays;
+    const auto& quads = geometry.quads;
+    for (size_t i = 0; i < quads.size(); i++) {
+        auto Q = quads.Q[i], u = quads.u[i], v = quads.v[i];
+        for (int n = 0; n <= 16; n++) {
+            auto s = real(n) / 16;
+            add_packet(rays, eye, Q + s*u, 1e-6 * u);
+            add_packet(rays, eye, Q + v + s*u, 1e-6 * u);
+            add_packet(rays, eye, Q + s*v, 1e-6 * v);
+            add_packet(rays, eye, Q + u + s*v, 1e-6 * v);
+        }
+        for (auto corner : {Q, Q + u, Q + v, Q + u + v})
+            add_packet(rays, eye + vec3::random(-1, 1), corner, 1e-7 * (u + v));
+    }
+    return rays;
+}
+
+std::vector<ray> sphere_silhouette_rays(const scene_geometry& geometry, const point3& eye) {
+    // Packets tangent to every sphere as seen from eye, around its outline.
+    std::vector<ray> rays;
+    const auto& spheres = geometry.spheres;
+    for (size_t i = 0; i < spheres.size(); i++) {
+        auto to_center = spheres.center[i] - eye;
+        auto w = unit_vector(to_center);
+        auto a = (std::fabs(w.x()) > 0.9) ? vec3(0,1,0) : vec3(1,0,0);
+        auto side = unit_vector(cross(w, a));
+        auto up = cross(w, side);
+        for (int n = 0; n < 8; n++) {
+            auto phi = 2 * pi * n / 8;
+            auto direction = std::cos(phi) * side + std::sin(phi) * up;
+            auto edge = spheres.center[i] + spheres.radius[i] * direction;
+            add_packet(rays, eye, edge, 1e-6 * spheres.radius[i] * direction);
+        }
+    }
+    return rays;
+}
+
+std::vector<ray> spread_times(const std::vector<ray>& rays) {
+    // The same rays with the lanes of each packet at different times.
+    std::vector<ray> spread;
+    for (size_t i = 0; i < rays.size(); i++)
+        spread.push_back(ray(rays[i].origin(), rays[i].direction(), real((i * 5) % ray_packet_size) / ray_packet_size));
+    return spread;
+}
+
+int main() {
+    int mismatches = 0;
+
+    material_table materials;
+    auto quads = quads_scene(materials);
+    mismatches += compare("quads, edges", primitive_bvh(quads), quad_edge_rays(quads, point3(0, 0, 9)));
+
+    auto box = cornell_box_scene(materials);
+    mismatches += compare("cornell box, edges", primitive_bvh(box), quad_edge_rays(box, point3(278, 278, -800)));
+
+    auto spheres = random_spheres_scene(materials);
+    mismatches += compare("random spheres, silhouettes", primitive_bvh(spheres),
+                          sphere_silhouette_rays(spheres, point3(13, 2, 3)));
+    mismatches += compare("random spheres, silhouettes, motion BVH", motion_bvh(spheres),
+                          spread_times(sphere_silhouette_rays(spheres, point3(13, 2, 3))));
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -12,13 +12,14 @@
 int main()
 {
     hittable_list world;
+    material_table materials;
 
     // Materials
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 0.2));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+    auto left_red = materials.add(make_shared<lambertian>(color(1.0, 0.2, 0.2)));
+    auto back_green = materials.add(make_shared<lambertian>(color(0.2, 1.0, 0.2)));
+    auto right_blue = materials.add(make_shared<lambertian>(color(0.2, 0.2, 0.2)));
+    auto upper_orange = materials.add(make_shared<lambertian>(color(1.0, 0.5, 0.0)));
+    auto lower_teal = materials.add(make_shared<lambertian>(color(0.2, 0.8, 0.8)));
 
     // Quads
     world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
@@ -0,0 +1,453 @@
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "camera.h"
+#include "lights.h"
+#include "motion_bvh.h"
+#include "primitive_bvh.h"
+#include "quad.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Benchmark suite. Renders the scene files at a fixed seed and reports primary and total rays per
+// second, times the BVH builds of each scene and of a dense synthetic scene, reports the BVH and
+// peak process memory, and microbenchmarks aabb::hit, sphere::hit and quad::hit. The results go
+// to a JSON file; given a baseline written by an earlier run with the same precision, mode and
+// thread count, every metric is compared with it and the exit status is 1 if a gated one is worse
+// by more than the tolerance. Timings are gated when their runs last gate_seconds or more, or when
+// they are the fastest of short rounds repeated over that long; the others are reported for
+// information. Refresh the baseline by writing the results over it. --quick
+// shrinks the renders and time budgets to check that the suite runs; its results can only be
+// compared with those of another quick run.
+// Usage: rt_bench [--scenes dir] [--out results.json] [--baseline baseline.json]
+//                 [--tolerance fraction] [--images dir] [--quick]
+
+using bench_clock = std::chrono::steady_clock;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Timed runs shorter than this vary by more than any useful tolerance from one run to the next,
+// so their timings are reported but never fail a comparison.
+const double gate_seconds = 0.5;
+
+// What the results depend on besides the code and the machine. Only runs with the same setup
+// can be compared: the renders and builds use every hardware thread.
+struct bench_setup {
+    std::string precision;
+    std::string mode; // "quick" or "full".
+    int threads = 0;
+
+    bool operator==(const bench_setup& other) const {
+        return precision == other.precision && mode == other.mode && threads == other.threads;
+    }
+
+    std::string describe() const {
+        auto known = [](const std::string& s) { return s.empty() ? std::string("unknown") : s; };
+        return known(mode) + " run, " + known(precision) + " precision, "
+             + (threads > 0 ? std::to_string(threads) : std::string("unknown")) + (threads == 1 ? " thread" : " threads");
+    }
+};
+
+bench_setup current_setup(bool quick) {
+    bench_setup setup;
+    setup.precision = sizeof(real) == sizeof(float) ? "float" : "double";
+    setup.mode = quick ? "quick" : "full";
+    setup.threads = thread_pool().size();
+    return setup;
+}
+
+// A named result. Names ending in _per_s are better when higher, names ending in _seconds or _mb
+// better when lower; the others are informational. Only gated metrics can fail a comparison.
+struct bench_metric {
+    std::string name;
+    double value;
+    bool gated;
+};
+
+// The results of a run, in the order they were measured.
+class bench_results {
+    public:
+    std::vector<bench_metric> metrics;
+
+    void add(const std::string& name, double value, bool gated = false) {
+        metrics.push_back({name, value, gated});
+        std::cout << std::left << std::setw(44) << name << std::right << std::setw(14)
+                  << std::setprecision(4) << value << (gated ? "  gated" : "") << '\n';
+    }
+
+    bool write_json(const std::string& path, const bench_setup& setup) const {
+        std::ofstream file(path);
+        file << "{\n  \"schema\": 3,\n  \"precision\": \"" << setup.precision << "\",\n  \"mode\": \"" << setup.mode
+             << "\",\n  \"threads\": " << setup.threads << ",\n  \"metrics\": {\n";
+        for (size_t i = 0; i < metrics.size(); i++) {
+            file << "    \"" << metrics[i].name << "\": " << std::setprecision(9) << metrics[i].value
+                 << (i + 1 < metrics.size() ? ",\n" : "\n");
+        }
+        file << "  },\n  \"gated\": [";
+        const char* separator = "";
+        for (const auto& metric : metrics) {
+            if (!metric.gated) continue;
+            file << separator << "\n    \"" << metric.name << '"';
+            separator = ",";
+        }
+        file << "\n  ]\n}\n";
+        return static_cast<bool>(file);
+    }
+};
+
+std::string json_member(const std::string& text, const std::string& name) {
+    // The value of the first "name": value member of text, a string without its quotes or a
+    // number as written, or an empty string.
+    auto key = text.find('"' + name + '"');
+    if (key == std::string::npos) return "";
+    auto colon = text.find_first_not_of(" \t\r\n", key + name.size() + 2);
+    if (colon == std::string::npos || text[colon] != ':') return "";
+    auto open = text.find_first_not_of(" \t\r\n", colon + 1);
+    if (open == std::string::npos) return "";
+    if (text[open] != '"') return text.substr(open, text.find_first_of(",}\r\n", open) - open);
+    auto close = text.find('"', open + 1);
+    return close == std::string::npos ? "" : text.substr(open + 1, close - open - 1);
+}
+
+bool read_json_metrics(const std::string& path, std::map<std::string, double>& metrics, bench_setup& setup) {
+    // Reads the "name": number pairs of a results file, and the setup it was run with; other
+    // members are skipped.
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    setup.precision = json_member(text, "precision");
+    setup.mode = json_member(text, "mode");
+    setup.threads = std::atoi(json_member(text, "threads").c_str());
+
+    size_t position = 0;
+    while ((position = text.find('"', position)) != std::string::npos) {
+        auto end = text.find('"', position + 1);
+        if (end == std::string::npos) break;
+        auto name = text.substr(position + 1, end - position - 1);
+        position = end + 1;
+
+        auto colon = text.find_first_not_of(" \t\r\n", position);
+        if (colon == std::string::npos || text[colon] != ':') continue;
+        const char* start = text.c_str() + colon + 1;
+        char* number_end = nullptr;
+        auto value = std::strtod(start, &number_end);
+        if (number_end != start) metrics[name] = value;
+    }
+    return true;
+}
+
+bool compare_with_baseline(const bench_results& results, const std::map<std::string, double>& baseline, double tolerance) {
+    // Prints each metric against the baseline; false if any gated metric is worse by more than
+    // tolerance.
+    auto ends_with = [](const std::string& s, const std::string& suffix) {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+
+    bool ok = true;
+    std::cout << "\ncompared with the baseline, tolerance " << tolerance * 100 << "%\n";
+    for (const auto& [name, value, gated] : results.metrics) {
+        auto found = baseline.find(name);
+        if (found == baseline.end()) {
+            std::cout << std::left << std::setw(44) << name << "  not in the baseline\n";
+            continue;
+        }
+
+        auto base = found->second;
+        bool higher_better = ends_with(name, "_per_s");
+        bool lower_better = ends_with(name, "_seconds") || ends_with(name, "_mb");
+        auto change = (base != 0) ? (value - base) / base : 0;
+        bool worse = (higher_better && value < base * (1 - tolerance)) || (lower_better && value > base * (1 + tolerance));
+        bool regressed = gated && worse;
+        if (regressed) ok = false;
+
+        const char* verdict = regressed ? "REGRESSED"
+                            : (gated && (higher_better || lower_better)) ? "ok"
+                            : (higher_better || lower_better) ? "info"
+                            : (value != base) ? "changed" : "";
+        std::cout << std::left << std::setw(44) << name << std::right << std::showpos << std::fixed
+                  << std::setprecision(1) << std::setw(9) << change * 100 << "%" << std::noshowpos
+                  << std::defaultfloat << "  " << verdict << '\n';
+    }
+    return ok;
+}
+
+double peak_memory_mb() {
+    // Peak resident set of the process so far, or 0 where it cannot be read.
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1e6;  // Bytes.
+#else
+    return usage.ru_maxrss / 1e3;  // Kilobytes.
+#endif
+#else
+    return 0;
+#endif
+}
+
+double bvh_megabytes(const primitive_bvh_data& bvh) {
+    // Nodes, leaves and the reordered primitives, as laid out in memory.
+    const auto& primitives = bvh.primitives;
+    double bytes = bvh.nodes.size() * sizeof(linear_bvh_node) + bvh.leaves.size() * sizeof(primitive_bvh_leaf)
+                 + primitives.spheres.size() * (7 * sizeof(real) + sizeof(material_id))
+                 + primitives.quads.size() * (16 * sizeof(real) + sizeof(material_id));
+    return bytes / 1e6;
+}
+
+// Forwards to the scene's BVH and counts the rays traced through it: closest-hit and shadow rays,
+// one by one or in packets.
+class counting_hittable : public hittable {
+    public:
+    explicit counting_hittable(const hittable& inner_param) : inner(inner_param) {}
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        rays.fetch_add(1, std::memory_order_relaxed);
+        return inner.intersect(r, ray_t, rec);
+    }
+
+    void intersect_packet(const ray* packet, int count, interval ray_t, hit_record* recs, bool* hits) const override {
+        rays.fetch_add(count, std::memory_order_relaxed);
+        inner.intersect_packet(packet, count, ray_t, recs, hits);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        rays.fetch_add(1, std::memory_order_relaxed);
+        return inner.occluded(r, ray_t);
+    }
+
+    aabb bounding_box() const override { return inner.bounding_box(); }
+
+    uint64_t count() const { return rays.load(); }
+
+    private:
+    const hittable& inner;
+    mutable std::atomic<uint64_t> rays{0};
+};
+
+// Discards what is written to it, to keep the camera's progress off the report.
+class null_buffer : public std::streambuf {
+    protected:
+    int overflow(int c) override { return c; }
+};
+
+template <typename Build>
+double best_build_seconds(Build build, double budget) {
+    // Fastest of as many builds as fit in about budget seconds, at least one.
+    double best = infinity;
+    auto start = bench_clock::now();
+    do {
+        auto build_start = bench_clock::now();
+        build();
+        best = std::min(best, seconds_since(build_start));
+    } while (seconds_since(start) < budget);
+    return best;
+}
+
+void bench_scene(bench_results& results, const std::string& name, const std::string& path, bool quick,
+                 const std::string& image_dir) {
+    scene_description scene;
+    if (!load_scene_file(path, scene)) {
+        std::cerr << "Skipping the scene '" << path << "'.\n";
+        return;
+    }
+
+    double budget = quick ? 0.05 : 0.5;
+    primitive_bvh_data bvh;
+    auto typed_seconds = best_build_seconds([&] { bvh = primitive_bvh::build(scene.geometry); }, budget);
+    auto list = scene.geometry.to_hittable_list();
+    auto node_seconds = best_build_seconds([&] { bvh_node tree(list); }, budget);
+    results.add("build." + name + ".primitive_bvh_seconds", typed_seconds, typed_seconds >= gate_seconds);
+    results.add("build." + name + ".bvh_node_seconds", node_seconds, node_seconds >= gate_seconds);
+    results.add("build." + name + ".primitive_bvh_mb", bvh_megabytes(bvh), true);
+
+    material_table materials;
+    add_scene_materials(scene.textures, scene.materials, materials);
+    light_list lights(bvh.primitives, materials);
+    // The BVH main.cc renders the scene with.
+    shared_ptr<hittable> world;
+    if (bvh.primitives.spheres.moving())
+        world = make_shared<motion_bvh>(bvh.primitives);
+    else
+        world = make_shared<primitive_bvh>(std::move(bvh));
+    counting_hittable counted(*world);
+
+    // The scene's own camera at a benchmark resolution and sample count.
+    camera cam;
+    scene.view.apply_to(cam);
+    cam.image_width = quick ? 96 : 240;
+    cam.samples_per_pixel = quick ? 4 : 64;
+    cam.seed = 1;
+    cam.output_file = image_dir + "/rt_bench_" + name + ".ppm";
+
+    // The fastest of a few renders. Every render traces the same rays.
+    const int renders = quick ? 1 : 3;
+    double seconds = infinity;
+    null_buffer discard;
+    auto* log = std::clog.rdbuf(&discard);
+    for (int i = 0; i < renders; i++) {
+        auto start = bench_clock::now();
+        cam.render(counted, materials, lights);
+        seconds = std::min(seconds, seconds_since(start));
+    }
+    std::clog.rdbuf(log);
+    auto rays = counted.count() / renders;
+
+    auto image_height = std::max(1, static_cast<int>(cam.image_width / cam.aspect_ratio));
+    double primary = double(cam.image_width) * image_height * cam.samples_per_pixel;
+    results.add("render." + name + ".primary_mrays_per_s", primary / seconds / 1e6, seconds >= gate_seconds);
+    results.add("render." + name + ".total_mrays_per_s", rays / seconds / 1e6, seconds >= gate_seconds);
+    results.add("render." + name + ".rays", double(rays));
+}
+
+void bench_dense_build(bench_results& results, bool quick) {
+    // Build times of a scene large enough to time reliably: random small spheres in a cube.
+    thread_rng().seed(7, 7);
+    scene_geometry geometry;
+    int count = quick ? 50000 : 300000;
+    for (int i = 0; i < count; i++)
+        geometry.spheres.add(point3::random(-50, 50), random_double(0.05, 0.5), 0);
+
+    double budget = quick ? 0.05 : 2;
+    primitive_bvh_data bvh;
+    auto typed_seconds = best_build_seconds([&] { bvh = primitive_bvh::build(geometry); }, budget);
+    results.add("build.dense.primitive_bvh_seconds", typed_seconds, typed_seconds >= gate_seconds);
+    auto list = geometry.to_hittable_list();
+    auto node_seconds = best_build_seconds([&] { bvh_node tree(list); }, budget);
+    results.add("build.dense.bvh_node_seconds", node_seconds, node_seconds >= gate_seconds);
+    results.add("build.dense.primitive_bvh_mb", bvh_megabytes(bvh), true);
+}
+
+template <typename Object, typename Test>
+double tests_per_second(const std::vector<Object>& objects, const std::vector<ray>& rays, double budget,
+                        long& hits, Test test) {
+    // Every ray against every object, in rounds until about budget seconds have passed. The
+    // fastest round counts, which keeps interruptions by other processes out of the result, and
+    // over a budget of gate_seconds or more makes the rate steady enough to gate.
+    double best = infinity;
+    auto start = bench_clock::now();
+    do {
+        auto round_start = bench_clock::now();
+        hits = 0;
+        for (const auto& r : rays)
+            for (const auto& object : objects)
+                hits += test(object, r);
+        best = std::min(best, seconds_since(round_start));
+    } while (seconds_since(start) < budget);
+    return double(rays.size()) * objects.size() / best;
+}
+
+void bench_primitives(bench_results& results, bool quick) {
+    // The same boxes, spheres, quads and rays on every run.
+    thread_rng().seed(1, 1);
+    std::vector<ray> rays;
+    for (int i = 0; i < 1024; i++) {
+        auto origin = point3::random(-20, 20);
+        rays.push_back(ray(origin, point3::random(-5, 5) - origin, random_double()));
+    }
+
+    std::vector<aabb> boxes;
+    std::vector<sphere> spheres;
+    std::vector<quad> quads;
+    for (int i = 0; i < 256; i++) {
+        auto corner = point3::random(-10, 10);
+        boxes.push_back(aabb(corner, corner + vec3::random(0.1, 2)));
+        spheres.push_back(sphere(point3::random(-10, 10), random_double(0.1, 2), 0));
+        quads.push_back(quad(point3::random(-10, 10), vec3::random(-2, 2), vec3::random(-2, 2), 0));
+    }
+
+    double budget = quick ? 0.05 : 0.5;
+    long hits;
+    auto box_rate = tests_per_second(boxes, rays, budget, hits, [](const aabb& box, const ray& r) {
+        return box.hit(r, interval(0.001, infinity));
+    });
+    results.add("micro.aabb_hit.mtests_per_s", box_rate / 1e6, budget >= gate_seconds);
+    results.add("micro.aabb_hit.hits", hits);
+
+    auto sphere_rate = tests_per_second(spheres, rays, budget, hits, [](const sphere& s, const ray& r) {
+        hit_record rec;
+        return s.hit(r, interval(0.001, infinity), rec);
+    });
+    results.add("micro.sphere_hit.mtests_per_s", sphere_rate / 1e6, budget >= gate_seconds);
+    results.add("micro.sphere_hit.hits", hits);
+
+    auto quad_rate = tests_per_second(quads, rays, budget, hits, [](const quad& q, const ray& r) {
+        hit_record rec;
+        return q.hit(r, interval(0.001, infinity), rec);
+    });
+    results.add("micro.quad_hit.mtests_per_s", quad_rate / 1e6, budget >= gate_seconds);
+    results.add("micro.quad_hit.hits", hits);
+}
+
+int main(int argc, char** argv) {
+    std::string scene_dir = "scenes", out = "rt_bench.json", baseline, image_dir = ".";
+    double tolerance = 0.1;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--quick") quick = true;
+        else if (arg == "--scenes" && has_value) scene_dir = argv[++i];
+        else if (arg == "--out" && has_value) out = argv[++i];
+        else if (arg == "--baseline" && has_value) baseline = argv[++i];
+        else if (arg == "--tolerance" && has_value) tolerance = std::atof(argv[++i]);
+        else if (arg == "--images" && has_value) image_dir = argv[++i];
+        else {
+            std::cerr << "Usage: rt_bench [--scenes dir] [--out results.json] [--baseline baseline.json]\n"
+                         "                [--tolerance fraction] [--images dir] [--quick]\n";
+            return 2;
+        }
+    }
+
+    bench_results results;
+    bench_primitives(results, quick);
+    for (const char* name : {"random_spheres", "two_spheres", "quads", "cornell_box"})
+        bench_scene(results, name, scene_dir + "/" + name + ".scene", quick, image_dir);
+    bench_dense_build(results, quick);
+    results.add("memory.peak_rss_mb", peak_memory_mb(), true);
+
+    auto setup = current_setup(quick);
+    if (!results.write_json(out, setup)) {
+        std::cerr << "Could not write the results to '" << out << "'.\n";
+        return 2;
+    }
+    std::cout << "results written to " << out << '\n';
+
+    if (baseline.empty()) return 0;
+    std::map<std::string, double> baseline_metrics;
+    bench_setup baseline_setup;
+    if (!read_json_metrics(baseline, baseline_metrics, baseline_setup)) {
+        std::cerr << "Could not read the baseline '" << baseline << "'.\n";
+        return 2;
+    }
+    if (!(baseline_setup == setup)) {
+        std::cerr << "The baseline '" << baseline << "' (" << baseline_setup.describe() << ") does not match this run ("
+                  << setup.describe() << ").\n";
+        return 2;
+    }
+    return compare_with_baseline(results, baseline_metrics, tolerance) ? 0 : 1;
+}
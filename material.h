@@ -5,12 +5,75 @@
 #include "hittable_list.h"
 #include "texture.h"
 
+#include <algorithm>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+// Kind of bounce a scattered ray makes, each with its own depth limit in the integrator.
+enum class bounce_kind { diffuse, specular, transmission };
+
 class material {
   public:
     virtual ~material() = default;
 
     virtual bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+    // Name of the material class, for reports.
+    virtual const char* type_name() const { return "material"; }
+
+    // Kind of the bounce that scatter() produced.
+    virtual bounce_kind bounce(const hit_record&, const ray&) const {
+        return bounce_kind::diffuse;
+    }
+
+    // Light given off at the hit point. Primitives with an emissive material become light sources.
+    virtual color emitted(const hit_record&) const { return color(0,0,0); }
+    virtual bool is_emissive() const { return false; }
+
+    // For light sampling at diffuse bounces: the BSDF times the cosine towards a direction, and
+    // the density, per unit solid angle, with which scatter() picks that direction. Both are 0
+    // for materials that cannot be evaluated this way; light sampling then contributes nothing.
+    virtual color evaluate(const ray&, const hit_record&, const vec3&) const {
+        return color(0,0,0);
+    }
+    virtual real scattering_pdf(const ray&, const hit_record&, const vec3&) const {
+        return 0;
+    }
+};
+
+// Scene-owned list of materials. Primitives and hit records refer to entries by material_id.
+// Materials are also numbered by class, in order of first appearance, so that work can be
+// grouped by the scatter() implementation it runs.
+class material_table {
+  public:
+    material_id add(shared_ptr<material> mat) {
+        auto type = std::find(types.begin(), types.end(), std::type_index(typeid(*mat)));
+        if (type == types.end()) {
+            types.push_back(typeid(*mat));
+            type_names.push_back(mat->type_name());
+            type = types.end() - 1;
+        }
+        material_types.push_back(static_cast<int>(type - types.begin()));
+
+        materials.push_back(mat);
+        return static_cast<material_id>(materials.size() - 1);
+    }
+
+    const material& operator[](material_id id) const { return *materials[id]; }
+
+    size_t size() const { return materials.size(); }
+
+    int type_of(material_id id) const { return material_types[id]; }
+    int type_count() const { return static_cast<int>(types.size()); }
+    const char* type_name(int type) const { return type_names[type]; }
+
+  private:
+    std::vector<shared_ptr<material>> materials;
+    std::vector<int> material_types;
+    std::vector<std::type_index> types;
+    std::vector<const char*> type_names;
 };
 
 class lambertian : public material {
@@ -19,61 +82,85 @@ class lambertian : public material {
     lambertian(shared_ptr<texture> a) : albedo(a) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
+        auto scatter_direction = rec.shading_normal + random_unit_vector();
         if (scatter_direction.near_zero()){
-            scatter_direction = rec.normal;
+            scatter_direction = rec.shading_normal;
         }
-        scattered = ray(rec.p, scatter_direction, r_in.time());
+        scattered = rec.spawn_ray(scatter_direction, r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
 
+    const char* type_name() const override { return "lambertian"; }
+
+    color evaluate(const ray& r_in, const hit_record& rec, const vec3& direction) const override {
+        // albedo / pi, times the cosine.
+        return albedo->value(rec.u, rec.v, rec.p) * scattering_pdf(r_in, rec, direction);
+    }
+
+    real scattering_pdf(const ray&, const hit_record& rec, const vec3& direction) const override {
+        // scatter() samples the cosine-weighted hemisphere.
+        auto cosine = dot(rec.shading_normal, unit_vector(direction));
+        return cosine > 0 ? cosine / pi : 0;
+    }
+
     private:
     shared_ptr<texture> albedo;
 };
 
 class metal : public material {
     public:
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz*random_unit_vector(), r_in.time());
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.shading_normal);
+        scattered = rec.spawn_ray(reflected + fuzz*random_unit_vector(), r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    const char* type_name() const override { return "metal"; }
+
+    bounce_kind bounce(const hit_record&, const ray&) const override { return bounce_kind::specular; }
+
     private:
     color albedo;
-    double fuzz;
+    real fuzz;
 };
 
 class dielectric : public material {
     public:
-    dielectric(double refraction_index) : _refraction_index(refraction_index) {}
+    dielectric(real refraction_index) : _refraction_index(refraction_index) {}
 
     bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
         attenuation = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0/_refraction_index) : _refraction_index;
+        real refraction_ratio = rec.front_face ? (1.0/_refraction_index) : _refraction_index;
 
         vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+        real cos_theta = fmin(dot(-unit_direction, rec.shading_normal), 1.0);
+        real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
         if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-            direction = reflect(unit_direction, rec.normal);
+            direction = reflect(unit_direction, rec.shading_normal);
         else
-            direction = refract(unit_direction, rec.normal, refraction_ratio);
+            direction = refract(unit_direction, rec.shading_normal, refraction_ratio);
         
-        scattered = ray(rec.p, direction, r_in.time());
+        scattered = rec.spawn_ray(direction, r_in.time());
         return true;
     }
 
+    const char* type_name() const override { return "dielectric"; }
+
+    bounce_kind bounce(const hit_record& rec, const ray& scattered) const override {
+        // The normal faces the incoming ray, so a refracted ray leaves against it.
+        return dot(scattered.direction(), rec.normal) < 0 ? bounce_kind::transmission : bounce_kind::specular;
+    }
+
     private:
-    double _refraction_index;
-    static double reflectance(double cosine, double ref_index) {
+    real _refraction_index;
+    static real reflectance(real cosine, real ref_index) {
         // Use Schlick's approximation for reflectance
         auto r0 = (1 - ref_index) / (1 + ref_index);
         r0 = r0*r0;
@@ -81,4 +168,21 @@ class dielectric : public material {
     }
 };
 
+class diffuse_light : public material {
+    public:
+    diffuse_light(shared_ptr<texture> a) : emit(a) {}
+    diffuse_light(const color& c) : emit(make_shared<solid_color>(c)) {}
+
+    bool scatter(const ray&, const hit_record&, color&, ray&) const override { return false; }
+
+    const char* type_name() const override { return "diffuse_light"; }
+
+    // Emits from both faces.
+    color emitted(const hit_record& rec) const override { return emit->value(rec.u, rec.v, rec.p); }
+    bool is_emissive() const override { return true; }
+
+    private:
+    shared_ptr<texture> emit;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,412 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+#include "triangle_mesh.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RT_MESH_MMAP
+#endif
+
+/* Mesh files.
+   Meshes load from Wavefront OBJ text or from a compact binary format (.rtmesh), both read
+   through a memory mapping of the whole file. OBJ files are parsed in parallel: the file is cut
+   into chunks at line breaks, each chunk is parsed on its own, and the chunks' vertices and faces
+   are then copied into place at offsets given by prefix sums of their counts. Faces with more
+   than three corners become triangle fans.
+
+   .rtmesh layout, little-endian: magic "RTMS", version, flags (bit 0: normal indices, bit 1: uv
+   indices), then the position, normal, uv and triangle counts (u64 each), followed by the
+   positions (3 floats each), normals (3 floats), uvs (2 floats) and the position, normal and uv
+   index lists (3 u32 per triangle each, the last two only when flagged).
+*/
+
+// A read-only view of a whole file, memory mapped where the platform allows, read into memory
+// otherwise.
+class mapped_file {
+    public:
+    explicit mapped_file(const std::string& path) {
+#ifdef RT_MESH_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            // Leave the file invalid.
+        } else if (info.st_size == 0) {
+            bytes = ""; // Nothing to map.
+        } else {
+            void* mapping = ::mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                ::madvise(mapping, size_t(info.st_size), MADV_SEQUENTIAL);
+                bytes = static_cast<const char*>(mapping);
+                length = size_t(info.st_size);
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = buffer.data() ? buffer.data() : "";
+        length = buffer.size();
+#endif
+    }
+
+    ~mapped_file() {
+#ifdef RT_MESH_MMAP
+        if (length > 0) ::munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool valid() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifndef RT_MESH_MMAP
+    std::vector<char> buffer;
+#endif
+};
+
+// The vertices and faces of one chunk of an OBJ file, before they are merged into a mesh_data.
+// Face corners hold OBJ indices already made zero-based: absolute ones as they are, and relative
+// (negative) ones as an offset from the chunk's first vertex plus obj_relative_index, since the
+// vertex counts of the earlier chunks are only known after parsing. obj_missing_index marks a
+// corner without that attribute.
+const int64_t obj_relative_index = int64_t(1) << 62;
+const int64_t obj_missing_index = -1;
+
+struct obj_chunk {
+    std::vector<float> positions, normals, uvs;
+    std::vector<int64_t> corners; // Position, uv and normal index of each triangle corner.
+    size_t first_position = 0, first_normal = 0, first_uv = 0, first_triangle = 0;
+    bool all_normals = true, all_uvs = true;
+    bool ok = true;
+};
+
+class obj_parser {
+    public:
+    obj_parser(const char* begin_param, const char* end_param) : p(begin_param), end(end_param) {}
+
+    void parse(obj_chunk& chunk) {
+        std::vector<int64_t> face;
+        while (p < end) {
+            skip_blanks();
+            if (p >= end) break;
+            if (p[0] == 'v' && p + 1 < end && is_blank(p[1])) {
+                p++;
+                read_floats(chunk.positions, 3, chunk.ok);
+            } else if (p[0] == 'v' && p + 2 < end && p[1] == 'n' && is_blank(p[2])) {
+                p += 2;
+                read_floats(chunk.normals, 3, chunk.ok);
+            } else if (p[0] == 'v' && p + 2 < end && p[1] == 't' && is_blank(p[2])) {
+                p += 2;
+                read_floats(chunk.uvs, 2, chunk.ok);
+                skip_line(); // Ignore an optional third texture coordinate.
+                continue;
+            } else if (p[0] == 'f' && p + 1 < end && is_blank(p[1])) {
+                p++;
+                read_face(chunk, face);
+            }
+            skip_line();
+        }
+    }
+
+    private:
+    const char* p;
+    const char* end;
+
+    static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void skip_blanks() { while (p < end && is_blank(*p)) p++; }
+
+    void skip_line() {
+        // Past the end of the current line; also used to move over lines that are not parsed.
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+    }
+
+    void read_floats(std::vector<float>& out, int count, bool& ok) {
+        for (int k = 0; k < count; k++) {
+            skip_blanks();
+            if (p < end && *p == '+') p++;
+            float value = 0;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc()) ok = false;
+            p = result.ptr;
+            out.push_back(value);
+        }
+    }
+
+    bool read_index(int64_t count_so_far, int64_t& index) {
+        // One OBJ index, made zero-based; see obj_chunk for the relative ones.
+        int64_t value = 0;
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || value == 0) return false;
+        p = result.ptr;
+        index = (value > 0) ? value - 1 : obj_relative_index + count_so_far + value;
+        return true;
+    }
+
+    void read_face(obj_chunk& chunk, std::vector<int64_t>& face) {
+        // Corners as v, v/vt, v//vn or v/vt/vn, fanned out into triangles.
+        face.clear();
+        while (true) {
+            skip_blanks();
+            if (p >= end || *p == '\n' || *p == '#') break;
+
+            int64_t v = obj_missing_index, vt = obj_missing_index, vn = obj_missing_index;
+            if (!read_index(int64_t(chunk.positions.size() / 3), v)) { chunk.ok = false; return; }
+            if (p < end && *p == '/') {
+                p++;
+                if (p < end && *p != '/' && !read_index(int64_t(chunk.uvs.size() / 2), vt)) { chunk.ok = false; return; }
+                if (p < end && *p == '/') {
+                    p++;
+                    if (!read_index(int64_t(chunk.normals.size() / 3), vn)) { chunk.ok = false; return; }
+                }
+            }
+            face.push_back(v);
+            face.push_back(vt);
+            face.push_back(vn);
+        }
+
+        size_t corner_count = face.size() / 3;
+        if (corner_count < 3) { chunk.ok = false; return; }
+        for (size_t k = 0; k < corner_count; k++) {
+            chunk.all_uvs = chunk.all_uvs && face[3*k + 1] != obj_missing_index;
+            chunk.all_normals = chunk.all_normals && face[3*k + 2] != obj_missing_index;
+        }
+        for (size_t k = 2; k < corner_count; k++) {
+            for (size_t corner : {size_t(0), k - 1, k})
+                chunk.corners.insert(chunk.corners.end(), face.begin() + 3*corner, face.begin() + 3*corner + 3);
+        }
+    }
+};
+
+inline bool resolve_obj_index(int64_t index, size_t chunk_first, size_t count, uint32_t& out) {
+    // The index into the whole mesh of an obj_chunk corner index, if it names an existing vertex.
+    if (index >= obj_relative_index / 2) index = int64_t(chunk_first) + (index - obj_relative_index);
+    if (index < 0 || uint64_t(index) >= count) return false;
+    out = static_cast<uint32_t>(index);
+    return true;
+}
+
+inline bool load_obj(const std::string& path, mesh_data& mesh, int thread_count = 0) {
+    mapped_file file(path);
+    if (!file.valid()) {
+        std::clog << "Could not open the mesh '" << path << "'.\n";
+        return false;
+    }
+
+    // Chunks of at least a megabyte, cut just after a line break.
+    thread_pool pool(thread_count);
+    const size_t min_chunk = size_t(1) << 20;
+    size_t chunk_count = std::max<size_t>(1, std::min<size_t>(8 * pool.size(), file.size() / min_chunk));
+    std::vector<const char*> cuts = {file.data()};
+    for (size_t k = 1; k < chunk_count; k++) {
+        const char* cut = file.data() + file.size() * k / chunk_count;
+        if (cut < cuts.back()) cut = cuts.back();
+        auto newline = static_cast<const char*>(std::memchr(cut, '\n', file.data() + file.size() - cut));
+        cuts.push_back(newline ? newline + 1 : file.data() + file.size());
+    }
+    cuts.push_back(file.data() + file.size());
+
+    std::vector<obj_chunk> chunks(chunk_count);
+    for (size_t k = 0; k < chunk_count; k++)
+        pool.submit([&, k] { obj_parser(cuts[k], cuts[k + 1]).parse(chunks[k]); });
+    pool.wait();
+
+    // Offsets of every chunk's data in the merged mesh.
+    size_t position_count = 0, normal_count = 0, uv_count = 0, triangle_count = 0;
+    bool all_normals = true, all_uvs = true;
+    for (size_t k = 0; k < chunk_count; k++) {
+        auto& chunk = chunks[k];
+        if (!chunk.ok) {
+            std::clog << "Could not parse the mesh '" << path << "'.\n";
+            return false;
+        }
+        chunk.first_position = position_count;
+        chunk.first_normal = normal_count;
+        chunk.first_uv = uv_count;
+        chunk.first_triangle = triangle_count;
+        position_count += chunk.positions.size() / 3;
+        normal_count += chunk.normals.size() / 3;
+        uv_count += chunk.uvs.size() / 2;
+        triangle_count += chunk.corners.size() / 9;
+        all_normals = all_normals && chunk.all_normals;
+        all_uvs = all_uvs && chunk.all_uvs;
+    }
+
+    // Attributes that some corner lacks are dropped for the whole mesh.
+    bool use_normals = all_normals && normal_count > 0;
+    bool use_uvs = all_uvs && uv_count > 0;
+    mesh = mesh_data();
+    mesh.positions.resize(position_count);
+    mesh.normals.resize(use_normals ? normal_count : 0);
+    mesh.uvs.resize(use_uvs ? 2 * uv_count : 0);
+    mesh.position_indices.resize(3 * triangle_count);
+    mesh.normal_indices.resize(use_normals ? 3 * triangle_count : 0);
+    mesh.uv_indices.resize(use_uvs ? 3 * triangle_count : 0);
+
+    std::vector<char> valid(chunk_count, 1);
+    for (size_t k = 0; k < chunk_count; k++) {
+        pool.submit([&, k] {
+            const auto& chunk = chunks[k];
+            for (size_t i = 0; i < chunk.positions.size() / 3; i++) {
+                const float* v = &chunk.positions[3*i];
+                mesh.positions[chunk.first_position + i] = point3(v[0], v[1], v[2]);
+            }
+            for (size_t i = 0; use_normals && i < chunk.normals.size() / 3; i++) {
+                const float* n = &chunk.normals[3*i];
+                mesh.normals[chunk.first_normal + i] = vec3(n[0], n[1], n[2]);
+            }
+            for (size_t i = 0; use_uvs && i < chunk.uvs.size(); i++)
+                mesh.uvs[2*chunk.first_uv + i] = chunk.uvs[i];
+
+            bool ok = true;
+            for (size_t c = 0; c < chunk.corners.size() / 3; c++) {
+                auto out = 3*chunk.first_triangle + c;
+                const int64_t* corner = &chunk.corners[3*c];
+                ok = ok && resolve_obj_index(corner[0], chunk.first_position, position_count, mesh.position_indices[out]);
+                if (use_uvs) ok = ok && resolve_obj_index(corner[1], chunk.first_uv, uv_count, mesh.uv_indices[out]);
+                if (use_normals) ok = ok && resolve_obj_index(corner[2], chunk.first_normal, normal_count, mesh.normal_indices[out]);
+            }
+            valid[k] = ok;
+        });
+    }
+    pool.wait();
+
+    for (auto ok : valid) {
+        if (!ok) {
+            std::clog << "The mesh '" << path << "' has a face index out of range.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+const uint32_t binary_mesh_magic = 0x534d5452; // "RTMS"
+const uint32_t binary_mesh_version = 1;
+
+inline bool write_binary_mesh(const std::string& path, const mesh_data& mesh) {
+    std::vector<char> out;
+    uint32_t flags = (mesh.normal_indices.empty() ? 0u : 1u) | (mesh.uv_indices.empty() ? 0u : 2u);
+    append_value(out, binary_mesh_magic);
+    append_value(out, binary_mesh_version);
+    append_value(out, flags);
+    append_value<uint64_t>(out, mesh.positions.size());
+    append_value<uint64_t>(out, mesh.normals.size());
+    append_value<uint64_t>(out, mesh.uvs.size() / 2);
+    append_value<uint64_t>(out, mesh.triangle_count());
+
+    out.reserve(out.size() + 12 * (mesh.positions.size() + mesh.normals.size()) + 4 * mesh.uvs.size()
+                + 4 * (mesh.position_indices.size() + mesh.normal_indices.size() + mesh.uv_indices.size()));
+    for (const auto* vectors : {&mesh.positions, &mesh.normals})
+        for (const auto& v : *vectors)
+            for (int a = 0; a < 3; a++) append_value(out, static_cast<float>(v[a]));
+    for (auto uv : mesh.uvs) append_value(out, static_cast<float>(uv));
+    for (const auto* indices : {&mesh.position_indices, &mesh.normal_indices, &mesh.uv_indices})
+        append_bytes(out, indices->data(), indices->size() * sizeof(uint32_t));
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(out.data(), out.size());
+    return static_cast<bool>(file);
+}
+
+inline bool load_binary_mesh(const std::string& path, mesh_data& mesh) {
+    mapped_file file(path);
+    if (!file.valid()) {
+        std::clog << "Could not open the mesh '" << path << "'.\n";
+        return false;
+    }
+
+    const size_t header_size = 3*4 + 4*8;
+    uint32_t header[3] = {};
+    uint64_t counts[4] = {};
+    if (file.size() >= header_size) {
+        std::memcpy(header, file.data(), sizeof(header));
+        std::memcpy(counts, file.data() + sizeof(header), sizeof(counts));
+    }
+    auto position_count = counts[0], normal_count = counts[1], uv_count = counts[2], triangle_count = counts[3];
+    bool has_normals = header[2] & 1u, has_uvs = header[2] & 2u;
+
+    uint64_t index_lists = 1 + (has_normals ? 1 : 0) + (has_uvs ? 1 : 0);
+    uint64_t expected = header_size + 12 * (position_count + normal_count) + 8 * uv_count + 12 * triangle_count * index_lists;
+    if (file.size() < header_size || header[0] != binary_mesh_magic || header[1] != binary_mesh_version
+        || counts[0] > UINT32_MAX || counts[1] > UINT32_MAX || counts[2] > UINT32_MAX || counts[3] > UINT32_MAX
+        || file.size() != expected) {
+        std::clog << "'" << path << "' is not a binary mesh of this version.\n";
+        return false;
+    }
+
+    // The floats are widened to real one by one; index lists are copied as they are.
+    const char* p = file.data() + header_size;
+    auto read_vectors = [&p](std::vector<vec3>& out, size_t count) {
+        out.resize(count);
+        for (size_t i = 0; i < count; i++, p += 12) {
+            float v[3];
+            std::memcpy(v, p, 12);
+            out[i] = vec3(v[0], v[1], v[2]);
+        }
+    };
+    auto read_indices = [&p](std::vector<uint32_t>& out, size_t count) {
+        out.resize(count);
+        std::memcpy(out.data(), p, count * sizeof(uint32_t));
+        p += count * sizeof(uint32_t);
+    };
+
+    mesh = mesh_data();
+    read_vectors(mesh.positions, position_count);
+    read_vectors(mesh.normals, normal_count);
+    mesh.uvs.resize(2 * uv_count);
+    for (size_t i = 0; i < mesh.uvs.size(); i++, p += 4) {
+        float uv;
+        std::memcpy(&uv, p, 4);
+        mesh.uvs[i] = uv;
+    }
+    read_indices(mesh.position_indices, 3 * triangle_count);
+    if (has_normals) read_indices(mesh.normal_indices, 3 * triangle_count);
+    if (has_uvs) read_indices(mesh.uv_indices, 3 * triangle_count);
+
+    auto in_range = [](const std::vector<uint32_t>& indices, uint64_t count) {
+        for (auto index : indices)
+            if (index >= count) return false;
+        return true;
+    };
+    if (!in_range(mesh.position_indices, position_count) || !in_range(mesh.normal_indices, normal_count)
+        || !in_range(mesh.uv_indices, uv_count)) {
+        std::clog << "The mesh '" << path << "' has a face index out of range.\n";
+        return false;
+    }
+    return true;
+}
+
+inline bool load_mesh(const std::string& path, mesh_data& mesh, int thread_count = 0) {
+    // By file extension: .obj or .rtmesh.
+    if (has_extension(path, ".obj")) return load_obj(path, mesh, thread_count);
+    if (has_extension(path, ".rtmesh")) return load_binary_mesh(path, mesh);
+    std::clog << "Unknown mesh format '" << path << "', expected .obj or .rtmesh.\n";
+    return false;
+}
+
+#endif
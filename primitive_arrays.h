@@ -0,0 +1,335 @@
+#ifndef PRIMITIVE_ARRAYS_H
+#define PRIMITIVE_ARRAYS_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "quad.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* Primitive storage by type.
+   Spheres and quads live in contiguous structure-of-arrays buffers, one array per scalar
+   component, instead of as individually allocated hittables. A primitive is named by its type
+   and its index in that type's arrays. The closest-hit loops over a range of one type make no
+   virtual calls and read every component as a unit-stride stream, which leaves them open to
+   vectorisation. Only the nearest primitive fills in a hit_record.
+*/
+
+enum class primitive_type : uint8_t { sphere, quad };
+
+// Three arrays holding the x, y and z components of a sequence of vectors.
+class vec3_array {
+    public:
+    std::vector<real> x, y, z;
+
+    void push_back(const vec3& v) {
+        x.push_back(v.x());
+        y.push_back(v.y());
+        z.push_back(v.z());
+    }
+
+    vec3 operator[](size_t i) const { return vec3(x[i], y[i], z[i]); }
+};
+
+class sphere_array {
+    public:
+    vec3_array center;  // Centre at time 0.
+    vec3_array motion;  // Centre at time 1 minus centre at time 0, zero for stationary spheres.
+    std::vector<real> radius;
+    std::vector<material_id> mat;
+
+    size_t size() const { return radius.size(); }
+
+    // Stationary sphere.
+    void add(const point3& center_param, real radius_param, material_id mat_param) {
+        add(center_param, center_param, radius_param, mat_param);
+    }
+
+    // Moving sphere, from center1 at time 0 to center2 at time 1.
+    void add(const point3& center1, const point3& center2, real radius_param, material_id mat_param) {
+        center.push_back(center1);
+        motion.push_back(center2 - center1);
+        radius.push_back(radius_param);
+        mat.push_back(mat_param);
+    }
+
+    void append(const sphere_array& other, size_t i) {
+        // Copy sphere i of another array to the end of this one.
+        center.push_back(other.center[i]);
+        motion.push_back(other.motion[i]);
+        radius.push_back(other.radius[i]);
+        mat.push_back(other.mat[i]);
+    }
+
+    point3 center_at(size_t i, real time) const { return center[i] + time*motion[i]; }
+
+    bool moving() const {
+        // Whether any sphere moves over the shutter interval.
+        for (size_t i = 0; i < size(); i++)
+            if (motion[i].length_squared() != 0) return true;
+        return false;
+    }
+
+    aabb bounding_box(size_t i) const {
+        auto rvec = vec3(radius[i], radius[i], radius[i]);
+        auto center1 = center[i];
+        auto center2 = center1 + motion[i];
+        return aabb(aabb(center1 - rvec, center1 + rvec), aabb(center2 - rvec, center2 + rvec));
+    }
+
+    aabb bounding_box_at(size_t i, real time) const {
+        // Bounds of sphere i at one instant, rather than over its whole motion.
+        auto rvec = vec3(radius[i], radius[i], radius[i]);
+        auto c = center_at(i, time);
+        return aabb(c - rvec, c + rvec);
+    }
+
+    size_t closest_hit(const ray& r, size_t start, size_t end, interval& ray_t) const {
+        // Index of the nearest sphere in [start, end) hit within ray_t, or end if there is none.
+        // A hit shrinks ray_t.
+        auto a = r.direction().length_squared();
+        size_t closest = end;
+        for (size_t i = start; i < end; i++) {
+            real root;
+            if (hit_root(i, r, a, ray_t, root)) {
+                ray_t.max = root;
+                closest = i;
+            }
+        }
+        return closest;
+    }
+
+    bool any_hit(const ray& r, size_t start, size_t end, interval ray_t) const {
+        // Whether any sphere in [start, end) is hit within ray_t, stopping at the first one.
+        auto a = r.direction().length_squared();
+        for (size_t i = start; i < end; i++) {
+            real root;
+            if (hit_root(i, r, a, ray_t, root)) return true;
+        }
+        return false;
+    }
+
+    void set_hit_record(size_t i, const ray& r, real t, hit_record& rec) const {
+        rec.t = t;
+        rec.p = r.at(t);
+        vec3 outward_normal = (rec.p - center_at(i, r.time())) / radius[i];
+        rec.set_face_normal(r, outward_normal);
+        sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat = mat[i];
+    }
+
+    vec3 random_direction(size_t i, const point3& origin, real time) const {
+        // Direction from origin into the cone of directions that see sphere i, uniformly over that
+        // solid angle. The zero vector when origin is inside the sphere.
+        vec3 to_center = center_at(i, time) - origin;
+        auto distance_squared = to_center.length_squared();
+        if (distance_squared <= radius[i]*radius[i]) return vec3(0,0,0);
+
+        auto cos_theta_max = std::sqrt(1 - radius[i]*radius[i] / distance_squared);
+        real z = 1 + random_double()*(cos_theta_max - 1);
+        auto phi = 2*pi*random_double();
+        auto sin_theta = std::sqrt(std::max(real(0), 1 - z*z));
+
+        // Orthonormal basis around the direction to the centre.
+        vec3 w = unit_vector(to_center);
+        vec3 a = (std::fabs(w.x()) > 0.9) ? vec3(0,1,0) : vec3(1,0,0);
+        vec3 v = unit_vector(cross(w, a));
+        vec3 u = cross(w, v);
+        return std::cos(phi)*sin_theta*u + std::sin(phi)*sin_theta*v + z*w;
+    }
+
+    real pdf_value(size_t i, const ray& r) const {
+        // Density of random_direction(i, r.origin(), r.time()) at r's direction.
+        interval ray_t(0, infinity);
+        if (closest_hit(r, i, i+1, ray_t) != i+1) {
+            auto distance_squared = (center_at(i, r.time()) - r.origin()).length_squared();
+            if (distance_squared > radius[i]*radius[i]) {
+                auto cos_theta_max = std::sqrt(1 - radius[i]*radius[i] / distance_squared);
+                return 1 / (2*pi*(1 - cos_theta_max));
+            }
+        }
+        return 0;
+    }
+
+    private:
+    bool hit_root(size_t i, const ray& r, real a, const interval& ray_t, real& root) const {
+        // The nearer root of sphere i within ray_t, for a = the squared length of r's direction.
+        // Uses the same robust discriminant and stable roots as sphere::hit.
+        const auto& dir = r.direction();
+        vec3 oc = r.origin() - center_at(i, r.time());
+        auto half_b = dot(oc, dir);
+        auto c = oc.length_squared() - radius[i]*radius[i];
+
+        vec3 perpendicular = oc - (half_b / a) * dir;
+        auto discriminant = a * (radius[i]*radius[i] - perpendicular.length_squared());
+        if (discriminant < 0) return false;
+        auto sqrtd = sqrt(discriminant);
+
+        auto q = -(half_b + std::copysign(sqrtd, half_b));
+        auto root0 = q / a;
+        auto root1 = (q != 0) ? c / q : root0;
+        auto near_root = (root1 < root0) ? root1 : root0;
+        auto far_root = (root1 < root0) ? root0 : root1;
+
+        root = ray_t.surrounds(near_root) ? near_root : far_root;
+        return ray_t.surrounds(root);
+    }
+};
+
+class quad_array {
+    public:
+    vec3_array Q;       // Corner.
+    vec3_array u, v;    // Edges from Q.
+    vec3_array normal;
+    std::vector<real> D; // Plane offset: dot(normal, p) = D.
+    vec3_array w;       // n / dot(n, n), maps a point on the plane to its (alpha, beta) coordinates.
+    std::vector<material_id> mat;
+
+    size_t size() const { return D.size(); }
+
+    void add(const point3& Q_param, const vec3& u_param, const vec3& v_param, material_id mat_param) {
+        auto n = cross(u_param, v_param);
+        auto unit_normal = unit_vector(n);
+        Q.push_back(Q_param);
+        u.push_back(u_param);
+        v.push_back(v_param);
+        normal.push_back(unit_normal);
+        D.push_back(dot(unit_normal, Q_param));
+        w.push_back(n / dot(n, n));
+        mat.push_back(mat_param);
+    }
+
+    void append(const quad_array& other, size_t i) {
+        // Copy quad i of another array to the end of this one.
+        Q.push_back(other.Q[i]);
+        u.push_back(other.u[i]);
+        v.push_back(other.v[i]);
+        normal.push_back(other.normal[i]);
+        D.push_back(other.D[i]);
+        w.push_back(other.w[i]);
+        mat.push_back(other.mat[i]);
+    }
+
+    aabb bounding_box(size_t i) const { return aabb(Q[i], Q[i] + u[i] + v[i]).pad(); }
+
+    size_t closest_hit(const ray& r, size_t start, size_t end, interval& ray_t) const {
+        // Index of the nearest quad in [start, end) hit within ray_t, or end if there is none.
+        // A hit shrinks ray_t.
+        size_t closest = end;
+        for (size_t i = start; i < end; i++) {
+            real t;
+            if (hit_distance(i, r, ray_t, t)) {
+                ray_t.max = t;
+                closest = i;
+            }
+        }
+        return closest;
+    }
+
+    bool any_hit(const ray& r, size_t start, size_t end, interval ray_t) const {
+        // Whether any quad in [start, end) is hit within ray_t, stopping at the first one.
+        for (size_t i = start; i < end; i++) {
+            real t;
+            if (hit_distance(i, r, ray_t, t)) return true;
+        }
+        return false;
+    }
+
+    void set_hit_record(size_t i, const ray& r, real t, hit_record& rec) const {
+        vec3 planar_hitpt_vec = r.at(t) - Q[i];
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.u = dot(w[i], cross(planar_hitpt_vec, v[i]));
+        rec.v = dot(w[i], cross(u[i], planar_hitpt_vec));
+        rec.mat = mat[i];
+        rec.set_face_normal(r, normal[i]);
+    }
+
+    vec3 random_direction(size_t i, const point3& origin) const {
+        // Direction from origin to a point picked uniformly over the area of quad i.
+        auto alpha = random_double();
+        auto beta = random_double();
+        return Q[i] + alpha*u[i] + beta*v[i] - origin;
+    }
+
+    real pdf_value(size_t i, const ray& r) const {
+        // Density of random_direction(i, r.origin()) at r's direction, per unit solid angle:
+        // the uniform area density 1/A, times distance squared over the cosine at the quad.
+        interval ray_t(0, infinity);
+        if (closest_hit(r, i, i+1, ray_t) == i+1) return 0;
+
+        auto length = r.direction().length();
+        auto distance = ray_t.max * length;
+        auto cosine = std::fabs(dot(normal[i], r.direction())) / length;
+        auto area = cross(u[i], v[i]).length();
+        return (cosine > 0) ? distance*distance / (cosine*area) : 0;
+    }
+
+    private:
+    bool hit_distance(size_t i, const ray& r, const interval& ray_t, real& t) const {
+        // Where r meets quad i, if within ray_t. Same tests as quad::hit.
+        auto n = normal[i];
+        auto denom = dot(n, r.direction());
+        t = (D[i] - dot(n, r.origin())) / denom;
+
+        vec3 planar_hitpt_vec = r.at(t) - Q[i];
+        auto alpha = dot(w[i], cross(planar_hitpt_vec, v[i]));
+        auto beta = dot(w[i], cross(u[i], planar_hitpt_vec));
+
+        return (std::fabs(denom) >= 1e-8) && ray_t.contains(t)
+            && (alpha >= 0) && (alpha <= 1) && (beta >= 0) && (beta <= 1);
+    }
+};
+
+// The primitives of a scene, by type. Primitive i of the whole scene is sphere i for
+// i < spheres.size() and quad i - spheres.size() otherwise.
+class scene_geometry {
+    public:
+    sphere_array spheres;
+    quad_array quads;
+
+    size_t size() const { return spheres.size() + quads.size(); }
+
+    primitive_type type(size_t i) const {
+        return (i < spheres.size()) ? primitive_type::sphere : primitive_type::quad;
+    }
+
+    aabb bounding_box(size_t i) const {
+        if (i < spheres.size()) return spheres.bounding_box(i);
+        return quads.bounding_box(i - spheres.size());
+    }
+
+    aabb bounding_box_at(size_t i, real time) const {
+        if (i < spheres.size()) return spheres.bounding_box_at(i, time);
+        return quads.bounding_box(i - spheres.size());
+    }
+
+    aabb bounding_box() const {
+        aabb box;
+        for (size_t i = 0; i < size(); i++)
+            box = aabb(box, bounding_box(i));
+        return box;
+    }
+
+    hittable_list to_hittable_list() const {
+        // The same primitives as individual hittables, for the BVHs built over a hittable_list.
+        hittable_list list;
+        for (size_t i = 0; i < spheres.size(); i++) {
+            auto center = spheres.center[i];
+            auto motion = spheres.motion[i];
+            if (motion.length_squared() == 0)
+                list.add(make_shared<sphere>(center, spheres.radius[i], spheres.mat[i]));
+            else
+                list.add(make_shared<sphere>(center, center + motion, spheres.radius[i], spheres.mat[i]));
+        }
+        for (size_t i = 0; i < quads.size(); i++)
+            list.add(make_shared<quad>(quads.Q[i], quads.u[i], quads.v[i], quads.mat[i]));
+        return list;
+    }
+};
+
+#endif
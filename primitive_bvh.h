@@ -0,0 +1,290 @@
+#ifndef PRIMITIVE_BVH_H
+#define PRIMITIVE_BVH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "primitive_arrays.h"
+#include "ray_packet.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* Flattened BVH over typed primitive arrays.
+   The tree is a linear_bvh tree, but its leaves name their primitives by type and index instead
+   of holding hittable pointers: the BVH keeps its own copy of the scene's sphere and quad arrays,
+   reordered so that the spheres of every leaf, and its quads, are one contiguous range each.
+   A leaf is intersected with one closest_hit loop per type; traversal records only the type and
+   index of the nearest primitive, whose hit record finalize_interaction fills in.
+   Packets of coherent rays share one traversal: a node is visited once for all the rays that
+   reach it, and its leaf primitives are tested ray by ray with the same loops as a single ray.
+*/
+
+// The primitives of one leaf: a range of the BVH's spheres and a range of its quads.
+struct primitive_bvh_leaf {
+    uint32_t sphere_offset;
+    uint32_t quad_offset;
+    uint16_t sphere_count;
+    uint16_t quad_count;
+};
+
+// A built primitive_bvh as plain arrays: its nodes, its leaves, and its primitives in leaf order.
+// The scene cache saves these and restores a BVH from them without building it again.
+struct primitive_bvh_data {
+    std::vector<linear_bvh_node> nodes; // Leaf offsets index `leaves`.
+    std::vector<primitive_bvh_leaf> leaves;
+    scene_geometry primitives;
+    aabb bbox;
+};
+
+class primitive_bvh : public hittable {
+    public:
+    primitive_bvh(const scene_geometry& geometry, const bvh_build_options& options = bvh_build_options())
+        : primitive_bvh(build(geometry, options)) {}
+
+    explicit primitive_bvh(primitive_bvh_data data)
+        : nodes(std::move(data.nodes)), leaves(std::move(data.leaves)), spheres(std::move(data.primitives.spheres)),
+          quads(std::move(data.primitives.quads)), bbox(data.bbox) {}
+
+    static primitive_bvh_data build(const scene_geometry& geometry, const bvh_build_options& options = bvh_build_options()) {
+        return build(geometry, options, [&](size_t i) { return geometry.bounding_box(i); });
+    }
+
+    // Builds the tree over the boxes box_of(i) of the primitives instead of their bounding boxes.
+    template <typename BoxFunction>
+    static primitive_bvh_data build(const scene_geometry& geometry, const bvh_build_options& options, BoxFunction box_of) {
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(geometry.size(), box_of, &pool);
+
+        auto tree = linear_bvh_builder(refs, &pool).build(options);
+        primitive_bvh_data data;
+        data.nodes = std::move(tree.nodes);
+
+        // Give every leaf a leaf record and copy its primitives, type by type, into leaf order.
+        auto& spheres = data.primitives.spheres;
+        auto& quads = data.primitives.quads;
+        for (auto& node : data.nodes) {
+            if (node.primitive_count == 0) continue;
+
+            primitive_bvh_leaf leaf = {static_cast<uint32_t>(spheres.size()), static_cast<uint32_t>(quads.size()), 0, 0};
+            for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++) {
+                auto index = tree.order[i];
+                if (geometry.type(index) == primitive_type::sphere) {
+                    spheres.append(geometry.spheres, index);
+                    leaf.sphere_count++;
+                } else {
+                    quads.append(geometry.quads, index - geometry.spheres.size());
+                    leaf.quad_count++;
+                }
+            }
+
+            node.offset = static_cast<uint32_t>(data.leaves.size());
+            data.leaves.push_back(leaf);
+        }
+
+        data.bbox = geometry.bounding_box();
+        return data;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return intersect_tree(nodes.data(), r, ray_t, rec);
+    }
+
+    void intersect_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const override {
+        intersect_packet_tree(nodes.data(), rays, count, ray_t, recs, hits);
+    }
+
+    void finalize_interaction(const ray& r, hit_record& rec) const override {
+        if (rec.primitive < spheres.size())
+            spheres.set_hit_record(rec.primitive, r, rec.t, rec);
+        else
+            quads.set_hit_record(rec.primitive - spheres.size(), r, rec.t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override { return occluded_tree(nodes.data(), r, ray_t); }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    protected:
+    // The traversals, over the tree whose root is `root` and whose leaf offsets index `leaves`:
+    // `nodes` itself, or another set of bounds for the same tree.
+    bool intersect_tree(const linear_bvh_node* root, const ray& r, interval ray_t, hit_record& rec) const {
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        // Nearest primitive so far, by type and index.
+        primitive_type closest_type = primitive_type::sphere;
+        size_t closest = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = root[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    const auto& leaf = leaves[node.offset];
+
+                    size_t sphere_end = leaf.sphere_offset + leaf.sphere_count;
+                    auto sphere_index = spheres.closest_hit(r, leaf.sphere_offset, sphere_end, ray_t);
+                    if (sphere_index != sphere_end) {
+                        closest_type = primitive_type::sphere;
+                        closest = sphere_index;
+                        hit_anything = true;
+                    }
+
+                    size_t quad_end = leaf.quad_offset + leaf.quad_count;
+                    auto quad_index = quads.closest_hit(r, leaf.quad_offset, quad_end, ray_t);
+                    if (quad_index != quad_end) {
+                        closest_type = primitive_type::quad;
+                        closest = quad_index;
+                        hit_anything = true;
+                    }
+                } else {
+                    // Visit the child nearer along the split axis first, the other one later.
+                    if (r.sign(node.axis)) {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+
+        if (!hit_anything) return false;
+
+        // Spheres first, then quads, in one primitive index.
+        rec.t = ray_t.max;
+        rec.object = this;
+        rec.primitive = static_cast<uint32_t>(closest_type == primitive_type::sphere ? closest : spheres.size() + closest);
+        return true;
+    }
+
+    void intersect_packet_tree(const linear_bvh_node* root, const ray* rays, int count, interval ray_t, hit_record* recs,
+                               bool* hits) const {
+        // Same traversal as intersect(), carrying the mask of rays still in each subtree. Child
+        // order follows the first of those rays; each ray keeps its own nearest hit and interval,
+        // so it finds exactly what intersect() would.
+        for (int k = 0; k < count; k++) hits[k] = false;
+        if (nodes.empty() || count <= 0) return;
+
+        ray_packet packet(rays, count, ray_t);
+        interval lane_t[ray_packet_size];
+        primitive_type closest_type[ray_packet_size];
+        size_t closest[ray_packet_size];
+        for (int k = 0; k < count; k++) lane_t[k] = ray_t;
+
+        struct stack_entry {
+            uint32_t node;
+            unsigned active;
+        };
+        stack_entry stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        unsigned active = packet.lanes();
+
+        while (true) {
+            const auto& node = root[current];
+            active = packet.may_hit(node) ? packet.hit_mask(node, active) : 0;
+
+            if (active != 0) {
+                if (node.primitive_count > 0) {
+                    const auto& leaf = leaves[node.offset];
+                    size_t sphere_end = leaf.sphere_offset + leaf.sphere_count;
+                    size_t quad_end = leaf.quad_offset + leaf.quad_count;
+
+                    for (unsigned lanes = active; lanes != 0; lanes &= lanes - 1) {
+                        int k = lowest_lane(lanes);
+                        auto sphere_index = spheres.closest_hit(rays[k], leaf.sphere_offset, sphere_end, lane_t[k]);
+                        if (sphere_index != sphere_end) {
+                            closest_type[k] = primitive_type::sphere;
+                            closest[k] = sphere_index;
+                            hits[k] = true;
+                        }
+                        auto quad_index = quads.closest_hit(rays[k], leaf.quad_offset, quad_end, lane_t[k]);
+                        if (quad_index != quad_end) {
+                            closest_type[k] = primitive_type::quad;
+                            closest[k] = quad_index;
+                            hits[k] = true;
+                        }
+                        packet.set_max(k, lane_t[k].max);
+                    }
+                } else {
+                    uint32_t near_child = current + 1, far_child = node.offset;
+                    if (rays[lowest_lane(active)].sign(node.axis)) std::swap(near_child, far_child);
+                    stack[stack_size++] = {far_child, active};
+                    current = near_child;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            --stack_size;
+            current = stack[stack_size].node;
+            active = stack[stack_size].active;
+        }
+
+        for (int k = 0; k < count; k++) {
+            if (!hits[k]) continue;
+            recs[k].t = lane_t[k].max;
+            recs[k].object = this;
+            recs[k].primitive = static_cast<uint32_t>(closest_type[k] == primitive_type::sphere ? closest[k] : spheres.size() + closest[k]);
+        }
+    }
+
+    bool occluded_tree(const linear_bvh_node* root, const ray& r, interval ray_t) const {
+        // Same traversal as intersect(), stopping at the first leaf with a primitive that blocks the ray.
+        if (nodes.empty()) return false;
+
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const auto& node = root[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    const auto& leaf = leaves[node.offset];
+                    if (spheres.any_hit(r, leaf.sphere_offset, leaf.sphere_offset + leaf.sphere_count, ray_t)
+                        || quads.any_hit(r, leaf.quad_offset, leaf.quad_offset + leaf.quad_count, ray_t))
+                        return true;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) return false;
+            current = stack[--stack_size];
+        }
+    }
+
+    static int lowest_lane(unsigned lanes) {
+        int k = 0;
+        while (!(lanes & 1u)) { lanes >>= 1; k++; }
+        return k;
+    }
+
+    std::vector<linear_bvh_node> nodes; // Leaf offsets index `leaves`.
+    std::vector<primitive_bvh_leaf> leaves;
+    sphere_array spheres;
+    quad_array quads;
+    aabb bbox;
+};
+
+#endif
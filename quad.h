@@ -7,7 +7,7 @@
 
 class quad : public hittable {
     public:
-    quad( const point3& _Q, const vec3& _u, const vec3& _v, shared_ptr<material> m) : Q(_Q), u(_u), v(_v), mat(m) {
+    quad( const point3& _Q, const vec3& _u, const vec3& _v, material_id m) : Q(_Q), u(_u), v(_v), mat(m) {
         auto n = cross(u, v);
         normal = unit_vector(n);
         D = dot(normal, Q);
@@ -21,38 +21,30 @@ class quad : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
-    bool hit (const ray& r, interval ray_t, hit_record& rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane
-        if(fabs(denom) < 1e-8) 
-            return false;
-        
-        // Return false if the hit point parameter t is outside the ray interval
-        auto t = (D - dot(normal,r.origin())) / denom;
-        if (!ray_t.contains(t))
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Records t and, through is_interior, the plane coordinates of the hit as its UVs.
+        real t;
+        if (!plane_hit(r, ray_t, t, rec))
             return false;
-        
-        // Determine the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vec = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vec, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vec));
-
-        if (!is_interior(alpha, beta, rec))
-            return false;
-
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
 
         rec.t = t;
-        rec.p = intersection;
+        rec.object = this;
+        return true;
+    }
+
+    void finalize_interaction(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
         rec.mat = mat;
         rec.set_face_normal(r, normal);
-        
-        return true;
     }
 
-        virtual bool is_interior(double a, double b, hit_record& rec) const {
+    bool occluded(const ray& r, interval ray_t) const override {
+        real t;
+        hit_record rec; // Only receives the plane coordinates from is_interior.
+        return plane_hit(r, ray_t, t, rec);
+    }
+
+        virtual bool is_interior(real a, real b, hit_record& rec) const {
         // Given the hit point in plane coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
 
@@ -67,11 +59,33 @@ class quad : public hittable {
     private:
     point3 Q; //Quadrilateral point of reference
     vec3 u, v; // Vectors setting sides 
-    shared_ptr<material> mat;
+    material_id mat;
     aabb bbox;
     vec3 normal;
-    double D; // Ax + By + Cz = D. 
+    real D; // Ax + By + Cz = D. 
     vec3 w;
+
+    bool plane_hit(const ray& r, const interval& ray_t, real& t, hit_record& rec) const {
+        // Ray parameter of the hit within ray_t, if r meets the shape. Sets only the hit record's
+        // UV coordinates, through is_interior.
+        auto denom = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane
+        if(fabs(denom) < 1e-8) 
+            return false;
+        
+        // Return false if the hit point parameter t is outside the ray interval
+        t = (D - dot(normal,r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+        
+        // Determine the hit point lies within the planar shape using its plane coordinates.
+        vec3 planar_hitpt_vec = r.at(t) - Q;
+        auto alpha = dot(w, cross(planar_hitpt_vec, v));
+        auto beta = dot(w, cross(u, planar_hitpt_vec));
+
+        return is_interior(alpha, beta, rec);
+    }
 };
 
 #endif
\ No newline at end of file
@@ -3,23 +3,38 @@
 
 #include "vec3.h"
 
-class ray {
+template <typename T>
+class basic_ray {
     public:
-    ray() {}
-    ray(const point3& origin, const vec3& direction) : orig(origin), dir (direction), tm(0) {}
+    basic_ray() {}
 
-    ray(const point3& origin, const vec3& direction, double time = 0.0) : orig(origin), dir(direction), tm(time) {}
+    basic_ray(const basic_vec3<T>& origin, const basic_vec3<T>& direction, T time = 0) : orig(origin), dir(direction), tm(time) {
+        // Cache the reciprocal direction and its signs, shared by every box test along the ray.
+        for (int a = 0; a < 3; a++) {
+            invert_dir[a] = 1 / dir[a];
+            dir_sign[a] = std::signbit(dir[a]) ? 1 : 0;
+        }
+    }
 
-    point3 origin() const { return orig; }
-    vec3 direction() const { return dir; }
-    double time() const { return tm; }
+    const basic_vec3<T>& origin() const { return orig; }
+    const basic_vec3<T>& direction() const { return dir; }
+    T time() const { return tm; }
 
-    point3 at(double t) const { return orig + t*dir; }
+    // 1/direction per axis; a zero component gives a signed infinity.
+    const basic_vec3<T>& invert_direction() const { return invert_dir; }
+    // 1 if the direction along the axis is negative (including -0), 0 otherwise.
+    int sign(int axis) const { return dir_sign[axis]; }
+
+    basic_vec3<T> at(T t) const { return orig + t*dir; }
     
     private:
-    point3 orig;
-    vec3 dir;
-    double tm;
+    basic_vec3<T> orig;
+    basic_vec3<T> dir;
+    T tm;
+    basic_vec3<T> invert_dir;
+    int dir_sign[3];
 };
 
-#endif
\ No newline at end of file
+using ray = basic_ray<real>;
+
+#endif
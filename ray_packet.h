@@ -0,0 +1,227 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+/* Ray packets.
+   Up to ray_packet_size rays that start close together and point in similar directions, such as
+   the camera rays of neighbouring pixels, traverse a flattened BVH together: each node is fetched
+   once for the whole packet and tested against all of its rays with one SIMD slab test, in AVX2
+   or SSE2 registers of real, a scalar loop otherwise (or with RT_NO_SIMD). The slab test does
+   the same operations in the same precision as linear_bvh_node_hit, including its widening of
+   the far distance, so every lane accepts exactly the nodes that its ray alone would.
+   When every ray of the packet has the same direction signs, an interval bound over the whole
+   packet first culls the nodes that none of its rays can reach, before any per-ray test.
+*/
+
+#if defined(__AVX2__) && !defined(RT_NO_SIMD)
+#include <immintrin.h>
+#define RT_RAY_PACKET_AVX2
+#elif (defined(__SSE2__) || defined(_M_X64)) && !defined(RT_NO_SIMD)
+#include <emmintrin.h>
+#define RT_RAY_PACKET_SSE
+#endif
+
+static_assert(ray_packet_size == 8, "the SIMD slab tests cover eight lanes");
+
+#if defined(RT_RAY_PACKET_AVX2) || defined(RT_RAY_PACKET_SSE)
+// The operations of the slab test on one register of lanes of T. max(a, b) and min(a, b) return
+// b when a is NaN, which matches the comparisons of linear_bvh_node_hit.
+template <typename T> struct packet_lanes;
+
+#if defined(RT_RAY_PACKET_AVX2)
+template <> struct packet_lanes<float> {
+    using lanes = __m256;
+    static const int width = 8;
+    static lanes load(const float* p) { return _mm256_load_ps(p); }
+    static lanes broadcast(float x) { return _mm256_set1_ps(x); }
+    static lanes select(lanes mask, lanes a, lanes b) { return _mm256_blendv_ps(b, a, mask); }
+    static lanes sub(lanes a, lanes b) { return _mm256_sub_ps(a, b); }
+    static lanes mul(lanes a, lanes b) { return _mm256_mul_ps(a, b); }
+    static lanes max(lanes a, lanes b) { return _mm256_max_ps(a, b); }
+    static lanes min(lanes a, lanes b) { return _mm256_min_ps(a, b); }
+    static unsigned less_equal(lanes a, lanes b) { return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ))); }
+};
+
+template <> struct packet_lanes<double> {
+    using lanes = __m256d;
+    static const int width = 4;
+    static lanes load(const double* p) { return _mm256_load_pd(p); }
+    static lanes broadcast(double x) { return _mm256_set1_pd(x); }
+    static lanes select(lanes mask, lanes a, lanes b) { return _mm256_blendv_pd(b, a, mask); }
+    static lanes sub(lanes a, lanes b) { return _mm256_sub_pd(a, b); }
+    static lanes mul(lanes a, lanes b) { return _mm256_mul_pd(a, b); }
+    static lanes max(lanes a, lanes b) { return _mm256_max_pd(a, b); }
+    static lanes min(lanes a, lanes b) { return _mm256_min_pd(a, b); }
+    static unsigned less_equal(lanes a, lanes b) { return unsigned(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ))); }
+};
+#else
+template <> struct packet_lanes<float> {
+    using lanes = __m128;
+    static const int width = 4;
+    static lanes load(const float* p) { return _mm_load_ps(p); }
+    static lanes broadcast(float x) { return _mm_set1_ps(x); }
+    static lanes select(lanes mask, lanes a, lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    static lanes sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+    static lanes mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+    static lanes max(lanes a, lanes b) { return _mm_max_ps(a, b); }
+    static lanes min(lanes a, lanes b) { return _mm_min_ps(a, b); }
+    static unsigned less_equal(lanes a, lanes b) { return unsigned(_mm_movemask_ps(_mm_cmple_ps(a, b))); }
+};
+
+template <> struct packet_lanes<double> {
+    using lanes = __m128d;
+    static const int width = 2;
+    static lanes load(const double* p) { return _mm_load_pd(p); }
+    static lanes broadcast(double x) { return _mm_set1_pd(x); }
+    static lanes select(lanes mask, lanes a, lanes b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+    static lanes sub(lanes a, lanes b) { return _mm_sub_pd(a, b); }
+    static lanes mul(lanes a, lanes b) { return _mm_mul_pd(a, b); }
+    static lanes max(lanes a, lanes b) { return _mm_max_pd(a, b); }
+    static lanes min(lanes a, lanes b) { return _mm_min_pd(a, b); }
+    static unsigned less_equal(lanes a, lanes b) { return unsigned(_mm_movemask_pd(_mm_cmple_pd(a, b))); }
+};
+#endif
+#endif
+
+class ray_packet {
+    public:
+    ray_packet(const ray* rays, int count_param, const interval& ray_t) : count(count_param) {
+        // The ray data of each lane, as the rays hold it. Unused lanes get an empty interval.
+        const real empty = std::numeric_limits<real>::infinity();
+        for (int lane = 0; lane < ray_packet_size; lane++) {
+            bool used = lane < count;
+            const ray& r = rays[used ? lane : 0];
+            for (int a = 0; a < 3; a++) {
+                origin[a][lane] = r.origin()[a];
+                invert_dir[a][lane] = r.invert_direction()[a];
+                // All bits set selects the max bound as the near one, for negative directions.
+                negative[a][lane] = r.sign(a);
+                auto bits = r.sign(a) ? ~lane_bits(0) : lane_bits(0);
+                std::memcpy(&sign_mask[a][lane], &bits, sizeof(real));
+            }
+            t_min[lane] = used ? ray_t.min : empty;
+            t_max[lane] = used ? ray_t.max : -empty;
+        }
+
+        // Packet bounds for the interval test: only when the signs agree and no component is zero.
+        coherent = true;
+        for (int a = 0; a < 3 && coherent; a++) {
+            sign[a] = rays[0].sign(a);
+            origin_lo[a] = origin_hi[a] = rays[0].origin()[a];
+            invert_lo[a] = invert_hi[a] = rays[0].invert_direction()[a];
+            for (int lane = 0; lane < count; lane++) {
+                double o = rays[lane].origin()[a];
+                double inv = rays[lane].invert_direction()[a];
+                if (rays[lane].sign(a) != sign[a] || std::isinf(inv)) coherent = false;
+                origin_lo[a] = std::min(origin_lo[a], o);
+                origin_hi[a] = std::max(origin_hi[a], o);
+                invert_lo[a] = std::min(invert_lo[a], inv);
+                invert_hi[a] = std::max(invert_hi[a], inv);
+            }
+        }
+    }
+
+    unsigned lanes() const { return (1u << count) - 1; }
+
+    void set_max(int lane, real t) { t_max[lane] = t; }
+
+    bool may_hit(const linear_bvh_node& node) const {
+        // Interval arithmetic over the packet: a lane enters the box no earlier than the latest,
+        // over the axes, of the earliest entry of any lane, and leaves it no later than the
+        // earliest, over the axes, of the latest exit. If even those bounds miss, every lane
+        // does. The bounds are slightly widened to stay conservative under rounding.
+        if (!coherent) return true;
+
+        double enter = std::numeric_limits<double>::infinity();
+        double leave = -std::numeric_limits<double>::infinity();
+        for (int lane = 0; lane < count; lane++) {
+            enter = std::min(enter, double(t_min[lane]));
+            leave = std::max(leave, double(t_max[lane]));
+        }
+        for (int a = 0; a < 3; a++) {
+            double near_bound = sign[a] ? node.bounds_max[a] : node.bounds_min[a];
+            double far_bound = sign[a] ? node.bounds_min[a] : node.bounds_max[a];
+            enter = std::max(enter, product_min(near_bound - origin_hi[a], near_bound - origin_lo[a], a));
+            leave = std::min(leave, product_max(far_bound - origin_hi[a], far_bound - origin_lo[a], a));
+        }
+        return enter <= leave + 1e-5 * (std::fabs(enter) + std::fabs(leave));
+    }
+
+    unsigned hit_mask(const linear_bvh_node& node, unsigned active) const {
+        // linear_bvh_node_hit for every lane. Returns the lanes of `active` that hit the node.
+        const real widen = 1 + 4*std::numeric_limits<real>::epsilon();
+        unsigned mask = 0;
+#if defined(RT_RAY_PACKET_AVX2) || defined(RT_RAY_PACKET_SSE)
+        using simd = packet_lanes<real>;
+        for (int group = 0; group < ray_packet_size; group += simd::width) {
+            auto near_t = simd::load(t_min + group);
+            auto far_t = simd::load(t_max + group);
+            for (int a = 0; a < 3; a++) {
+                auto use_max = simd::load(sign_mask[a] + group);
+                auto lo = simd::broadcast(node.bounds_min[a]);
+                auto hi = simd::broadcast(node.bounds_max[a]);
+                auto o = simd::load(origin[a] + group);
+                auto inv = simd::load(invert_dir[a] + group);
+                auto t0 = simd::mul(simd::sub(simd::select(use_max, hi, lo), o), inv);
+                auto t1 = simd::mul(simd::sub(simd::select(use_max, lo, hi), o), inv);
+                near_t = simd::max(t0, near_t);
+                far_t = simd::min(t1, far_t);
+            }
+            mask |= simd::less_equal(near_t, simd::mul(far_t, simd::broadcast(widen))) << group;
+        }
+#else
+        for (int lane = 0; lane < ray_packet_size; lane++) {
+            real near_t = t_min[lane], far_t = t_max[lane];
+            for (int a = 0; a < 3; a++) {
+                real near_bound = negative[a][lane] ? node.bounds_max[a] : node.bounds_min[a];
+                real far_bound = negative[a][lane] ? node.bounds_min[a] : node.bounds_max[a];
+                real t0 = (near_bound - origin[a][lane]) * invert_dir[a][lane];
+                real t1 = (far_bound - origin[a][lane]) * invert_dir[a][lane];
+                near_t = (t0 > near_t) ? t0 : near_t;
+                far_t = (t1 < far_t) ? t1 : far_t;
+            }
+            if (near_t <= far_t * widen) mask |= 1u << lane;
+        }
+#endif
+        return mask & active;
+    }
+
+    private:
+    int count;
+    // An unsigned integer as wide as a real, for the bits of sign_mask.
+    using lane_bits = std::conditional_t<sizeof(real) == sizeof(uint64_t), uint64_t, uint32_t>;
+
+    alignas(32) real origin[3][ray_packet_size];
+    alignas(32) real invert_dir[3][ray_packet_size];
+    alignas(32) real sign_mask[3][ray_packet_size]; // All bits set or clear, per lane.
+    alignas(32) real t_min[ray_packet_size];
+    alignas(32) real t_max[ray_packet_size];
+    bool negative[3][ray_packet_size];
+
+    bool coherent;
+    int sign[3];
+    double origin_lo[3], origin_hi[3];
+    double invert_lo[3], invert_hi[3];
+
+    double product_min(double x_lo, double x_hi, int a) const {
+        // Smallest product of x in [x_lo, x_hi] and the inverse direction range of axis a.
+        return std::min(std::min(x_lo * invert_lo[a], x_lo * invert_hi[a]),
+                        std::min(x_hi * invert_lo[a], x_hi * invert_hi[a]));
+    }
+
+    double product_max(double x_lo, double x_hi, int a) const {
+        return std::max(std::max(x_lo * invert_lo[a], x_lo * invert_hi[a]),
+                        std::max(x_hi * invert_lo[a], x_hi * invert_hi[a]));
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -12,6 +13,14 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Scalar type of the geometry and shading math. Define RT_USE_FLOAT for a single precision build.
+
+#ifdef RT_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -19,13 +28,114 @@ const double pi = 3.1415926535897932385;
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees) {
+inline real degrees_to_radians(real degrees) {
     return degrees * pi / 180.0;
 }
 
+// Random Numbers
+
+class rng {
+    // PCG32 generator (pcg-random.org): 64-bit state, 32-bit output, 2^63 selectable streams.
+    public:
+    rng() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    rng(uint64_t initstate, uint64_t stream) { seed(initstate, stream); }
+
+    void seed(uint64_t initstate, uint64_t stream) {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        auto rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    double next_double() {
+        // Return a random real in [0, 1) with 32 bits of resolution.
+        return next_uint() * 0x1p-32;
+    }
+
+    void advance(uint64_t delta) {
+        // Skip the next delta outputs in O(log delta) steps (Brown, "Random number generation
+        // with arbitrary strides"): compose the LCG step with itself by repeated squaring.
+        uint64_t step_mult = 6364136223846793005ULL, step_plus = inc;
+        uint64_t total_mult = 1, total_plus = 0;
+        while (delta > 0) {
+            if (delta & 1) {
+                total_mult *= step_mult;
+                total_plus = total_plus * step_mult + step_plus;
+            }
+            step_plus = (step_mult + 1) * step_plus;
+            step_mult *= step_mult;
+            delta >>= 1;
+        }
+        state = total_mult * state + total_plus;
+    }
+
+    private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+inline uint64_t mix_bits(uint64_t v) {
+    // SplitMix64 finaliser, turns nearby integers into unrelated 64-bit values.
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+inline rng& thread_rng() {
+    // Each thread draws from its own generator, so samplers never contend on shared state.
+    static thread_local rng generator;
+    return generator;
+}
+
+inline void seed_sample_stream(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    // Restart this thread's generator on the stream owned by (seed, pixel, sample), so a sample
+    // draws the same numbers whichever thread renders it and in whatever order.
+    thread_rng().seed(mix_bits(seed ^ mix_bits(sample)), mix_bits(seed + pixel));
+}
+
+// Source of the numbers random_double() returns while a camera renders. The camera installs one
+// sampler per render thread (sampler.h); with none installed random_double() uses thread_rng().
+class sampler {
+    public:
+    virtual ~sampler() = default;
+
+    // Begin sample `sample` of pixel (x, y). The following next_1d() calls return its dimensions
+    // 0, 1, 2, ... in order.
+    virtual void start_sample(int x, int y, int sample) = 0;
+
+    // The next dimension of the current sample, in [0, 1).
+    virtual double next_1d() = 0;
+
+    // Number of dimensions of the current sample drawn so far.
+    virtual uint64_t current_dimension() const = 0;
+
+    // Continue sample `sample` of pixel (x, y) at dimension `dimension`, as if start_sample had
+    // been followed by that many next_1d() calls. Lets one sampler serve many paths in turns.
+    virtual void resume_sample(int x, int y, int sample, uint64_t dimension) = 0;
+};
+
+inline sampler*& thread_sampler() {
+    static thread_local sampler* current = nullptr;
+    return current;
+}
+
 inline double random_double(){
     // Return a random real in [0, 1).
-    return rand() / (RAND_MAX + 1.0);
+    if (auto current = thread_sampler())
+        return current->next_1d();
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max){
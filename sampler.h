@@ -0,0 +1,356 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* Sample patterns.
+   A sampler hands out the dimensions of one pixel sample at a time (see class sampler in
+   rtweekend.h). The camera draws the pixel position from dimensions 0 and 1, then the lens
+   position and the time, and every bounce after that takes the dimensions its material asks for.
+     independent  Uncorrelated PCG streams, one per (pixel, sample).
+     stratified   Latin hypercube: each dimension puts the pixel's samples in distinct strata.
+     sobol        Owen-scrambled Sobol points, one 2D point set per pair of dimensions.
+     blue_noise   Sobol points shared by all pixels, each pixel offset by a blue-noise mask so the
+                  remaining error looks like high frequency noise at low sample counts.
+*/
+
+enum class sample_pattern { independent, stratified, sobol, blue_noise };
+
+// Largest double below 1.
+const double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+inline uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+inline uint32_t owen_scramble(uint32_t v, uint32_t seed) {
+    // Hash-based nested uniform scramble (Burley 2020): each bit is flipped depending only on the
+    // bits above it, which randomises a (0, m, 2) net without breaking its stratification.
+    v = reverse_bits(v);
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return reverse_bits(v);
+}
+
+inline uint32_t sobol_2d(uint32_t index, int dimension) {
+    // The first two Sobol dimensions: van der Corput, and the one from polynomial x + 1.
+    if (dimension == 0) return reverse_bits(index);
+
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+inline uint32_t permute_index(uint32_t i, uint32_t count, uint32_t seed) {
+    // Element i of a random permutation of [0, count) chosen by seed (Kensler 2013).
+    uint32_t w = count - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= count);
+    return (i + seed) % count;
+}
+
+class independent_sampler : public sampler {
+    public:
+    independent_sampler(uint64_t seed_param, int image_width_param)
+        : seed(seed_param), image_width(image_width_param) {}
+
+    void start_sample(int x, int y, int sample) override {
+        seed_sample_stream(seed, uint64_t(y) * image_width + x, sample);
+        dimension = 0;
+    }
+
+    double next_1d() override {
+        dimension++;
+        return thread_rng().next_double();
+    }
+
+    uint64_t current_dimension() const override { return dimension; }
+
+    void resume_sample(int x, int y, int sample, uint64_t dimension_param) override {
+        start_sample(x, y, sample);
+        thread_rng().advance(dimension_param);
+        dimension = dimension_param;
+    }
+
+    private:
+    uint64_t seed;
+    int image_width;
+    uint64_t dimension = 0;
+};
+
+class stratified_sampler : public sampler {
+    public:
+    stratified_sampler(uint64_t seed_param, int samples_per_pixel, int image_width_param)
+        : seed(seed_param), strata(static_cast<uint32_t>(std::max(samples_per_pixel, 1))),
+          image_width(image_width_param) {}
+
+    void start_sample(int x, int y, int sample) override {
+        pixel_seed = mix_bits(seed + uint64_t(y) * image_width + x);
+        sample_index = static_cast<uint32_t>(sample);
+        dimension = 0;
+    }
+
+    double next_1d() override {
+        // The sample's stratum in this dimension comes from a per-pixel, per-dimension permutation,
+        // its position inside the stratum from a hash.
+        auto hash = mix_bits(pixel_seed ^ mix_bits(dimension++));
+        auto stratum = permute_index(sample_index % strata, strata, static_cast<uint32_t>(hash));
+        auto jitter = static_cast<uint32_t>(mix_bits(hash + sample_index) >> 32) * 0x1p-32;
+        return std::min((stratum + jitter) / strata, one_minus_epsilon);
+    }
+
+    uint64_t current_dimension() const override { return dimension; }
+
+    void resume_sample(int x, int y, int sample, uint64_t dimension_param) override {
+        start_sample(x, y, sample);
+        dimension = dimension_param;
+    }
+
+    private:
+    uint64_t seed;
+    uint32_t strata;
+    int image_width;
+    uint64_t pixel_seed = 0;
+    uint32_t sample_index = 0;
+    uint64_t dimension = 0;
+};
+
+class sobol_sampler : public sampler {
+    public:
+    sobol_sampler(uint64_t seed_param, int image_width_param)
+        : seed(seed_param), image_width(image_width_param) {}
+
+    void start_sample(int x, int y, int sample) override {
+        pixel_seed = mix_bits(seed + uint64_t(y) * image_width + x);
+        sample_index = static_cast<uint32_t>(sample);
+        dimension = 0;
+    }
+
+    double next_1d() override {
+        // Every pair of dimensions is its own 2D Sobol set. Scrambling the index per pixel and pair
+        // shuffles the order of its points, which decorrelates the pairs from one another (Burley's
+        // padding); scrambling the values makes every pixel's point set different.
+        auto pair_seed = mix_bits(pixel_seed ^ mix_bits(dimension / 2));
+        auto index = owen_scramble(sample_index, static_cast<uint32_t>(pair_seed));
+        auto value_seed = static_cast<uint32_t>(pair_seed >> 32) ^ static_cast<uint32_t>(dimension % 2) * 0x9e3779b9u;
+        auto value = owen_scramble(sobol_2d(index, static_cast<int>(dimension % 2)), value_seed);
+        dimension++;
+        return value * 0x1p-32;
+    }
+
+    uint64_t current_dimension() const override { return dimension; }
+
+    void resume_sample(int x, int y, int sample, uint64_t dimension_param) override {
+        start_sample(x, y, sample);
+        dimension = dimension_param;
+    }
+
+    private:
+    uint64_t seed;
+    int image_width;
+    uint64_t pixel_seed = 0;
+    uint32_t sample_index = 0;
+    uint64_t dimension = 0;
+};
+
+// Edge length of the tiled blue-noise mask; a power of two.
+const int blue_noise_size = 64;
+
+inline std::vector<float> make_blue_noise_mask() {
+    // Rank every cell of a toroidal blue_noise_size^2 grid with void-and-cluster (Ulichney 1993):
+    // cells are ranked in the order in which they fill the largest remaining gap. The result maps
+    // each cell to (rank + 0.5) / cell count, a uniform value with blue-noise spatial structure.
+    const int size = blue_noise_size;
+    const int cells = size * size;
+    const float sigma = 1.5f;
+
+    std::vector<float> kernel(cells);
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            int wx = std::min(dx, size - dx), wy = std::min(dy, size - dy);
+            kernel[dy * size + dx] = std::exp(-(wx*wx + wy*wy) / (2 * sigma * sigma));
+        }
+    }
+
+    std::vector<float> energy(cells, 0.0f);
+    std::vector<char> filled(cells, 0);
+    auto splat = [&](int cell, float weight) {
+        int cx = cell % size, cy = cell / size;
+        for (int y = 0; y < size; y++) {
+            const float* row = &kernel[((y - cy) & (size - 1)) * size];
+            for (int x = 0; x < size; x++)
+                energy[y * size + x] += weight * row[(x - cx) & (size - 1)];
+        }
+    };
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int c = 0; c < cells; c++)
+            if (filled[c] && (best < 0 || energy[c] > energy[best])) best = c;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int c = 0; c < cells; c++)
+            if (!filled[c] && (best < 0 || energy[c] < energy[best])) best = c;
+        return best;
+    };
+
+    // Initial pattern: a tenth of the cells at random, then relaxed by moving the tightest cluster
+    // into the largest void until that move would put the cell back where it was.
+    rng generator(0x5eed, 0xb10e);
+    int initial = cells / 10;
+    for (int placed = 0; placed < initial; ) {
+        auto c = static_cast<int>(generator.next_uint() % cells);
+        if (filled[c]) continue;
+        filled[c] = 1;
+        splat(c, 1.0f);
+        placed++;
+    }
+    for (int moves = 0; moves < cells; moves++) {
+        auto cluster = tightest_cluster();
+        filled[cluster] = 0;
+        splat(cluster, -1.0f);
+        auto gap = largest_void();
+        filled[gap] = 1;
+        splat(gap, 1.0f);
+        if (gap == cluster) break;
+    }
+
+    std::vector<int> rank(cells);
+    auto initial_filled = filled;
+    auto initial_energy = energy;
+
+    // Ranks below the initial count: remove the tightest cluster, one at a time.
+    for (int r = initial - 1; r >= 0; r--) {
+        auto cluster = tightest_cluster();
+        filled[cluster] = 0;
+        splat(cluster, -1.0f);
+        rank[cluster] = r;
+    }
+
+    // The other ranks: fill the largest void, one at a time.
+    filled = initial_filled;
+    energy = initial_energy;
+    for (int r = initial; r < cells; r++) {
+        auto gap = largest_void();
+        filled[gap] = 1;
+        splat(gap, 1.0f);
+        rank[gap] = r;
+    }
+
+    std::vector<float> mask(cells);
+    for (int c = 0; c < cells; c++)
+        mask[c] = (rank[c] + 0.5f) / cells;
+    return mask;
+}
+
+inline const std::vector<float>& blue_noise_mask() {
+    static const std::vector<float> mask = make_blue_noise_mask();
+    return mask;
+}
+
+class blue_noise_sampler : public sampler {
+    public:
+    explicit blue_noise_sampler(uint64_t seed_param) : seed(seed_param), mask(blue_noise_mask()) {}
+
+    void start_sample(int x_param, int y_param, int sample) override {
+        x = x_param;
+        y = y_param;
+        sample_index = static_cast<uint32_t>(sample);
+        dimension = 0;
+    }
+
+    double next_1d() override {
+        // All pixels share one scrambled Sobol sequence, rotated toroidally (Cranley-Patterson) by
+        // the mask value under the pixel. Each dimension reads the mask at its own random offset.
+        auto pair_seed = mix_bits(seed ^ mix_bits(dimension / 2));
+        auto index = owen_scramble(sample_index, static_cast<uint32_t>(pair_seed));
+        auto value_seed = static_cast<uint32_t>(pair_seed >> 32) ^ static_cast<uint32_t>(dimension % 2) * 0x9e3779b9u;
+        double value = owen_scramble(sobol_2d(index, static_cast<int>(dimension % 2)), value_seed) * 0x1p-32;
+
+        auto offset = mix_bits(seed + 0x632be59bd9b4e019ULL * (dimension + 1));
+        int mx = (x + static_cast<int>(offset & 0xffff)) & (blue_noise_size - 1);
+        int my = (y + static_cast<int>((offset >> 16) & 0xffff)) & (blue_noise_size - 1);
+        value += mask[my * blue_noise_size + mx];
+        dimension++;
+
+        if (value >= 1) value -= 1;
+        return std::min(value, one_minus_epsilon);
+    }
+
+    uint64_t current_dimension() const override { return dimension; }
+
+    void resume_sample(int x_param, int y_param, int sample, uint64_t dimension_param) override {
+        start_sample(x_param, y_param, sample);
+        dimension = dimension_param;
+    }
+
+    private:
+    uint64_t seed;
+    const std::vector<float>& mask;
+    int x = 0, y = 0;
+    uint32_t sample_index = 0;
+    uint64_t dimension = 0;
+};
+
+inline std::unique_ptr<sampler> make_sampler(sample_pattern pattern, uint64_t seed, int samples_per_pixel,
+                                             int image_width) {
+    switch (pattern) {
+        case sample_pattern::stratified: return std::make_unique<stratified_sampler>(seed, samples_per_pixel, image_width);
+        case sample_pattern::sobol:      return std::make_unique<sobol_sampler>(seed, image_width);
+        case sample_pattern::blue_noise: return std::make_unique<blue_noise_sampler>(seed);
+        default:                         return std::make_unique<independent_sampler>(seed, image_width);
+    }
+}
+
+// Installs a sampler as this thread's source of random_double() for the lifetime of the scope.
+class sampler_scope {
+    public:
+    explicit sampler_scope(sampler* installed) : previous(thread_sampler()) { thread_sampler() = installed; }
+    ~sampler_scope() { thread_sampler() = previous; }
+
+    sampler_scope(const sampler_scope&) = delete;
+    sampler_scope& operator=(const sampler_scope&) = delete;
+
+    private:
+    sampler* previous;
+};
+
+#endif
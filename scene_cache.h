@@ -0,0 +1,255 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "rtweekend.h"
+#include "framebuffer.h"
+#include "linear_bvh.h"
+#include "mesh_loader.h"
+#include "primitive_bvh.h"
+#include "scene_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Compiled scene cache.
+   Building the BVH is most of the time it takes to start rendering a large scene. The first
+   render of a scene file saves the parsed records and the built BVH, with its primitives already
+   in leaf order, next to the file (.rtscene). Later renders of an unchanged file memory map the
+   cache and copy its arrays into place whole: nothing is parsed and nothing is built. The cache
+   names the scene file's contents by a hash, so an edited scene is parsed and built again, and
+   the cache rewritten.
+
+   Layout, in the byte order and precision of the machine that wrote it: magic "RTSC", version,
+   size of a real (u32 each), hash of the scene file (u64), then the texture, material, node,
+   leaf, sphere and quad counts (u64 each), followed by the scene_camera record, the texture and
+   material records, the BVH bounds (6 reals), the nodes and leaves, and the sphere and quad
+   arrays of scene_geometry, one after the other in the order of for_each_geometry_array.
+*/
+
+// The contents of a scene file, ready to render.
+class compiled_scene {
+    public:
+    scene_camera view;
+    std::vector<scene_texture> textures;
+    std::vector<scene_material> materials;
+    primitive_bvh_data bvh;
+};
+
+const uint32_t scene_cache_magic = 0x43535452; // "RTSC"
+const uint32_t scene_cache_version = 1;
+
+inline uint64_t scene_source_hash(const char* data, size_t size) {
+    // 64-bit FNV-1a.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline std::string scene_cache_path(const std::string& scene_path) {
+    // scenes/quads.scene caches to scenes/quads.rtscene, a path without an extension to path.rtscene.
+    auto slash = scene_path.find_last_of('/');
+    auto dot = scene_path.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return scene_path + ".rtscene";
+    return scene_path.substr(0, dot) + ".rtscene";
+}
+
+template <typename Geometry, typename Visit>
+void for_each_geometry_array(Geometry& geometry, Visit visit) {
+    // Every array of the spheres, then of the quads, with the primitive count it holds.
+    auto sphere_count = geometry.spheres.size();
+    auto quad_count = geometry.quads.size();
+    for (auto* v : {&geometry.spheres.center, &geometry.spheres.motion}) {
+        visit(v->x, sphere_count);
+        visit(v->y, sphere_count);
+        visit(v->z, sphere_count);
+    }
+    visit(geometry.spheres.radius, sphere_count);
+    visit(geometry.spheres.mat, sphere_count);
+
+    for (auto* v : {&geometry.quads.Q, &geometry.quads.u, &geometry.quads.v, &geometry.quads.normal}) {
+        visit(v->x, quad_count);
+        visit(v->y, quad_count);
+        visit(v->z, quad_count);
+    }
+    visit(geometry.quads.D, quad_count);
+    visit(geometry.quads.w.x, quad_count);
+    visit(geometry.quads.w.y, quad_count);
+    visit(geometry.quads.w.z, quad_count);
+    visit(geometry.quads.mat, quad_count);
+}
+
+inline bool write_scene_cache(const std::string& path, uint64_t source_hash, const compiled_scene& scene) {
+    // Writes a temporary file and renames it over path, so that a render starting meanwhile
+    // never maps a half-written cache.
+    const auto& primitives = scene.bvh.primitives;
+    std::vector<char> out;
+    append_value(out, scene_cache_magic);
+    append_value(out, scene_cache_version);
+    append_value<uint32_t>(out, sizeof(real));
+    append_value(out, source_hash);
+    for (size_t count : {scene.textures.size(), scene.materials.size(), scene.bvh.nodes.size(), scene.bvh.leaves.size(),
+                         primitives.spheres.size(), primitives.quads.size()})
+        append_value<uint64_t>(out, count);
+
+    append_value(out, scene.view);
+    append_bytes(out, scene.textures.data(), scene.textures.size() * sizeof(scene_texture));
+    append_bytes(out, scene.materials.data(), scene.materials.size() * sizeof(scene_material));
+    for (const auto* axis : {&scene.bvh.bbox.x, &scene.bvh.bbox.y, &scene.bvh.bbox.z}) {
+        append_value(out, axis->min);
+        append_value(out, axis->max);
+    }
+    append_bytes(out, scene.bvh.nodes.data(), scene.bvh.nodes.size() * sizeof(linear_bvh_node));
+    append_bytes(out, scene.bvh.leaves.data(), scene.bvh.leaves.size() * sizeof(primitive_bvh_leaf));
+    for_each_geometry_array(primitives, [&out](const auto& values, size_t) {
+        append_bytes(out, values.data(), values.size() * sizeof(values[0]));
+    });
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(out.data(), out.size());
+        if (!file.flush()) return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+inline bool valid_compiled_scene(const compiled_scene& scene) {
+    // Every index and kind in the scene is in range, and the tree is no deeper than the traversal
+    // stack, so a damaged cache cannot send traversal astray.
+    for (size_t i = 0; i < scene.textures.size(); i++) {
+        const auto& t = scene.textures[i];
+        if (int32_t(t.kind) < int32_t(scene_texture_kind::solid) || int32_t(t.kind) > int32_t(scene_texture_kind::checker))
+            return false;
+        if (t.kind == scene_texture_kind::checker
+            && (t.even < 0 || t.odd < 0 || size_t(t.even) >= i || size_t(t.odd) >= i))
+            return false;
+    }
+    for (const auto& m : scene.materials) {
+        if (int32_t(m.kind) < int32_t(scene_material_kind::lambertian)
+            || int32_t(m.kind) > int32_t(scene_material_kind::diffuse_light))
+            return false;
+        if (m.texture >= int64_t(scene.textures.size()) || m.texture < -1) return false;
+    }
+
+    // Children follow their parents, so one pass finds the longest path to every node. An
+    // interior node at depth d leaves up to d + 1 entries on the stack of intersect().
+    const auto& nodes = scene.bvh.nodes;
+    std::vector<int> depths(nodes.size(), 0);
+    for (size_t k = 0; k < nodes.size(); k++) {
+        const auto& node = nodes[k];
+        if (node.primitive_count > 0) {
+            if (node.offset >= scene.bvh.leaves.size()) return false;
+            continue;
+        }
+        if (k + 1 >= nodes.size() || node.offset <= k || node.offset >= nodes.size()
+            || depths[k] + 1 > linear_bvh_builder::max_stack_depth)
+            return false;
+        depths[k + 1] = std::max(depths[k + 1], depths[k] + 1);
+        depths[node.offset] = std::max(depths[node.offset], depths[k] + 1);
+    }
+
+    const auto& primitives = scene.bvh.primitives;
+    for (const auto& leaf : scene.bvh.leaves)
+        if (size_t(leaf.sphere_offset) + leaf.sphere_count > primitives.spheres.size()
+            || size_t(leaf.quad_offset) + leaf.quad_count > primitives.quads.size())
+            return false;
+    for (const auto* mats : {&primitives.spheres.mat, &primitives.quads.mat})
+        for (auto mat : *mats)
+            if (mat >= scene.materials.size()) return false;
+    return true;
+}
+
+inline bool load_scene_cache(const std::string& path, uint64_t source_hash, compiled_scene& scene) {
+    // Returns false if the cache is missing, damaged, of another version or precision, or made
+    // from another scene file.
+    mapped_file file(path);
+    if (!file.valid()) return false;
+
+    const size_t header_size = 3*4 + 8 + 6*8;
+    uint32_t header[3] = {};
+    uint64_t hash = 0;
+    uint64_t counts[6] = {};
+    if (file.size() < header_size) return false;
+    std::memcpy(header, file.data(), sizeof(header));
+    std::memcpy(&hash, file.data() + sizeof(header), sizeof(hash));
+    std::memcpy(counts, file.data() + sizeof(header) + sizeof(hash), sizeof(counts));
+    if (header[0] != scene_cache_magic || header[1] != scene_cache_version || header[2] != sizeof(real) || hash != source_hash)
+        return false;
+    for (auto count : counts)
+        if (count > UINT32_MAX) return false;
+
+    auto texture_count = counts[0], material_count = counts[1], node_count = counts[2], leaf_count = counts[3];
+    auto sphere_count = counts[4], quad_count = counts[5];
+    uint64_t expected = header_size + sizeof(scene_camera) + texture_count * sizeof(scene_texture)
+                      + material_count * sizeof(scene_material) + 6 * sizeof(real) + node_count * sizeof(linear_bvh_node)
+                      + leaf_count * sizeof(primitive_bvh_leaf) + sphere_count * (7 * sizeof(real) + sizeof(material_id))
+                      + quad_count * (16 * sizeof(real) + sizeof(material_id));
+    if (file.size() != expected) return false;
+
+    const char* p = file.data() + header_size;
+    auto read_array = [&p](auto& values, size_t count) {
+        values.resize(count);
+        std::memcpy(values.data(), p, count * sizeof(values[0]));
+        p += count * sizeof(values[0]);
+    };
+
+    scene = compiled_scene();
+    std::memcpy(&scene.view, p, sizeof(scene_camera));
+    p += sizeof(scene_camera);
+    read_array(scene.textures, texture_count);
+    read_array(scene.materials, material_count);
+    real bounds[6];
+    std::memcpy(bounds, p, sizeof(bounds));
+    p += sizeof(bounds);
+    scene.bvh.bbox = aabb(interval(bounds[0], bounds[1]), interval(bounds[2], bounds[3]), interval(bounds[4], bounds[5]));
+    read_array(scene.bvh.nodes, node_count);
+    read_array(scene.bvh.leaves, leaf_count);
+
+    // Size the arrays first: for_each_geometry_array passes each one the count of its type.
+    auto& primitives = scene.bvh.primitives;
+    primitives.spheres.radius.resize(sphere_count);
+    primitives.quads.D.resize(quad_count);
+    for_each_geometry_array(primitives, read_array);
+
+    return valid_compiled_scene(scene);
+}
+
+inline bool load_scene(const std::string& path, compiled_scene& scene, bool& from_cache,
+                       const bvh_build_options& options = bvh_build_options()) {
+    // From the cache when it matches the scene file, else by parsing the file and building its
+    // BVH, which then replaces the cache.
+    mapped_file file(path);
+    if (!file.valid()) {
+        std::clog << "Could not open the scene '" << path << "'.\n";
+        return false;
+    }
+    auto hash = scene_source_hash(file.data(), file.size());
+    auto cache_path = scene_cache_path(path);
+
+    from_cache = load_scene_cache(cache_path, hash, scene);
+    if (from_cache) return true;
+
+    scene_description description;
+    if (!parse_scene(std::string(file.data(), file.size()), path, description)) return false;
+
+    scene = compiled_scene();
+    scene.view = description.view;
+    scene.textures = std::move(description.textures);
+    scene.materials = std::move(description.materials);
+    scene.bvh = primitive_bvh::build(description.geometry, options);
+
+    if (!write_scene_cache(cache_path, hash, scene))
+        std::clog << "Could not write the scene cache '" << cache_path << "'.\n";
+    return true;
+}
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "material.h"
+#include "primitive_arrays.h"
+#include "scenes.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Scene files.
+   A scene file describes the camera, textures, materials and primitives of a scene in text, one
+   statement per line; # starts a comment. Textures and materials are named, and later lines refer
+   to them by name. Numbers may be written as fractions, like 16/9.
+
+     camera image_width 400 aspect_ratio 16/9 samples_per_pixel 100 max_depth 50
+     camera vertical_field_view 20 lookfrom 13 2 3 lookat 0 0 0 v_up 0 1 0
+     camera defocus_angle 0.6 focus_distance 10 sky 1 background 0 0 0
+
+     texture <name> solid <r g b>
+     texture <name> checker <scale> <even texture> <odd texture>
+
+     material <name> lambertian <r g b | texture>
+     material <name> metal <r g b> <fuzz>
+     material <name> dielectric <refraction index>
+     material <name> diffuse_light <r g b | texture>
+
+     sphere <center> <radius> <material>
+     moving_sphere <center at time 0> <center at time 1> <radius> <material>
+     quad <Q> <u> <v> <material>
+     box <corner> <opposite corner> <material>
+
+   Camera settings not given keep the camera's defaults. The parsed scene is plain data: records
+   for the camera, textures and materials, and the scene_geometry, so that scene_cache.h can save
+   it as it is.
+*/
+
+// The camera settings a scene file can give.
+struct scene_camera {
+    real aspect_ratio = 16.0 / 9.0;
+    int32_t image_width = 800;
+    int32_t samples_per_pixel = 10;
+    int32_t max_depth = 10;
+    int32_t sky = 1;
+    real vertical_field_view = 90;
+    point3 lookfrom = point3(0, 0, -1);
+    point3 lookat = point3(0, 0, 0);
+    vec3 v_up = vec3(0, 1, 0);
+    real defocus_angle = 0;
+    real focus_distance = 10;
+    color background = color(0, 0, 0);
+
+    void apply_to(camera& cam) const {
+        cam.aspect_ratio = aspect_ratio;
+        cam.image_width = image_width;
+        cam.samples_per_pixel = samples_per_pixel;
+        cam.max_depth = max_depth;
+        cam.sky = sky != 0;
+        cam.vertical_field_view = vertical_field_view;
+        cam.lookfrom = lookfrom;
+        cam.lookat = lookat;
+        cam.v_up = v_up;
+        cam.defocus_angle = defocus_angle;
+        cam.focus_distance = focus_distance;
+        cam.background = background;
+    }
+};
+
+enum class scene_texture_kind : int32_t { solid, checker };
+
+struct scene_texture {
+    scene_texture_kind kind = scene_texture_kind::solid;
+    int32_t even = 0; // Checker: indices of the two textures, both defined earlier.
+    int32_t odd = 0;
+    real scale = 1;
+    color value = color(0, 0, 0); // Solid.
+};
+
+enum class scene_material_kind : int32_t { lambertian, metal, dielectric, diffuse_light };
+
+struct scene_material {
+    scene_material_kind kind = scene_material_kind::lambertian;
+    int32_t texture = -1;   // Lambertian and diffuse_light: texture index, or -1 for the colour.
+    color value = color(0, 0, 0);
+    real parameter = 0;     // Metal: fuzz. Dielectric: refraction index.
+};
+
+static_assert(std::is_trivially_copyable<scene_camera>::value && std::is_trivially_copyable<scene_texture>::value
+              && std::is_trivially_copyable<scene_material>::value, "scene records are saved byte for byte");
+
+class scene_description {
+    public:
+    scene_camera view;
+    std::vector<scene_texture> textures;
+    std::vector<scene_material> materials; // Material i of the scene is material_id i.
+    scene_geometry geometry;
+};
+
+inline void add_scene_materials(const std::vector<scene_texture>& textures, const std::vector<scene_material>& materials,
+                                material_table& table) {
+    // Adds the materials in order, so that scene material i gets material_id i in an empty table.
+    std::vector<shared_ptr<texture>> made;
+    for (const auto& t : textures) {
+        if (t.kind == scene_texture_kind::checker)
+            made.push_back(make_shared<checker_texture>(t.scale, made[t.even], made[t.odd]));
+        else
+            made.push_back(make_shared<solid_color>(t.value));
+    }
+
+    for (const auto& m : materials) {
+        auto albedo = (m.texture >= 0) ? made[m.texture] : make_shared<solid_color>(m.value);
+        switch (m.kind) {
+        case scene_material_kind::lambertian:    table.add(make_shared<lambertian>(albedo)); break;
+        case scene_material_kind::metal:         table.add(make_shared<metal>(m.value, m.parameter)); break;
+        case scene_material_kind::dielectric:    table.add(make_shared<dielectric>(m.parameter)); break;
+        case scene_material_kind::diffuse_light: table.add(make_shared<diffuse_light>(albedo)); break;
+        }
+    }
+}
+
+// Reads the statements of a scene file one line at a time.
+class scene_parser {
+    public:
+    scene_parser(const std::string& path_param, scene_description& scene_param) : path(path_param), scene(scene_param) {}
+
+    bool parse(const std::string& text) {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            line_number++;
+            auto comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+
+            std::istringstream words(line);
+            tokens.assign(std::istream_iterator<std::string>(words), std::istream_iterator<std::string>());
+            next = 0;
+            if (tokens.empty()) continue;
+            if (!statement()) return false;
+        }
+        return true;
+    }
+
+    private:
+    const std::string& path;
+    scene_description& scene;
+    std::map<std::string, int32_t> texture_names;
+    std::map<std::string, int32_t> material_names;
+    std::vector<std::string> tokens;
+    size_t next = 0;
+    int line_number = 0;
+
+    bool error(const std::string& message) {
+        std::clog << path << ':' << line_number << ": " << message << '\n';
+        return false;
+    }
+
+    bool at_end() const { return next == tokens.size(); }
+
+    bool word(std::string& out) {
+        if (at_end()) return error("unexpected end of line");
+        out = tokens[next++];
+        return true;
+    }
+
+    static bool to_number(const std::string& token, real& out) {
+        // A decimal number, or a fraction of two.
+        const char* start = token.c_str();
+        char* end = nullptr;
+        auto value = std::strtod(start, &end);
+        if (end == start) return false;
+        if (*end == '/') {
+            const char* denominator_start = end + 1;
+            auto denominator = std::strtod(denominator_start, &end);
+            if (end == denominator_start || denominator == 0) return false;
+            value /= denominator;
+        }
+        out = real(value);
+        return *end == '\0';
+    }
+
+    bool number(real& out) {
+        std::string token;
+        if (!word(token)) return false;
+        if (!to_number(token, out)) return error("expected a number, found '" + token + "'");
+        return true;
+    }
+
+    bool integer(int32_t& out) {
+        real value;
+        if (!number(value)) return false;
+        if (value != std::floor(value) || value < 0 || value > 1e9) return error("expected a whole number");
+        out = static_cast<int32_t>(value);
+        return true;
+    }
+
+    bool vector(vec3& out) {
+        real x, y, z;
+        if (!number(x) || !number(y) || !number(z)) return false;
+        out = vec3(x, y, z);
+        return true;
+    }
+
+    bool name(const std::map<std::string, int32_t>& names, const char* what, int32_t& out) {
+        std::string token;
+        if (!word(token)) return false;
+        auto found = names.find(token);
+        if (found == names.end()) return error(std::string("unknown ") + what + " '" + token + "'");
+        out = found->second;
+        return true;
+    }
+
+    bool new_name(std::map<std::string, int32_t>& names, const char* what, int32_t index) {
+        std::string token;
+        if (!word(token)) return false;
+        if (!names.emplace(token, index).second) return error(std::string("the ") + what + " '" + token + "' is already defined");
+        return true;
+    }
+
+    bool colour_or_texture(scene_material& m) {
+        // Three numbers, or the name of a texture.
+        real red;
+        if (!at_end() && to_number(tokens[next], red)) return vector(m.value);
+        return name(texture_names, "texture", m.texture);
+    }
+
+    bool statement() {
+        std::string keyword;
+        word(keyword);
+
+        bool ok = true;
+        if (keyword == "camera") {
+            ok = camera_settings();
+        } else if (keyword == "texture") {
+            ok = texture_statement();
+        } else if (keyword == "material") {
+            ok = material_statement();
+        } else if (keyword == "sphere" || keyword == "moving_sphere") {
+            point3 center1, center2;
+            real radius;
+            int32_t mat;
+            ok = vector(center1);
+            if (keyword == "sphere") center2 = center1;
+            else ok = ok && vector(center2);
+            ok = ok && number(radius) && name(material_names, "material", mat);
+            if (ok) scene.geometry.spheres.add(center1, center2, radius, mat);
+        } else if (keyword == "quad") {
+            point3 Q;
+            vec3 u, v;
+            int32_t mat;
+            ok = vector(Q) && vector(u) && vector(v) && name(material_names, "material", mat);
+            if (ok) scene.geometry.quads.add(Q, u, v, mat);
+        } else if (keyword == "box") {
+            point3 a, b;
+            int32_t mat;
+            ok = vector(a) && vector(b) && name(material_names, "material", mat);
+            if (ok) add_box(scene.geometry, a, b, mat);
+        } else {
+            return error("unknown statement '" + keyword + "'");
+        }
+
+        if (ok && !at_end()) return error("unexpected '" + tokens[next] + "'");
+        return ok;
+    }
+
+    bool camera_settings() {
+        // Pairs of a setting and its value.
+        auto& view = scene.view;
+        while (!at_end()) {
+            std::string setting;
+            word(setting);
+            bool ok;
+            if (setting == "aspect_ratio")             ok = number(view.aspect_ratio);
+            else if (setting == "image_width")         ok = integer(view.image_width);
+            else if (setting == "samples_per_pixel")   ok = integer(view.samples_per_pixel);
+            else if (setting == "max_depth")           ok = integer(view.max_depth);
+            else if (setting == "sky")                 ok = integer(view.sky);
+            else if (setting == "vertical_field_view") ok = number(view.vertical_field_view);
+            else if (setting == "lookfrom")            ok = vector(view.lookfrom);
+            else if (setting == "lookat")              ok = vector(view.lookat);
+            else if (setting == "v_up")                ok = vector(view.v_up);
+            else if (setting == "defocus_angle")       ok = number(view.defocus_angle);
+            else if (setting == "focus_distance")      ok = number(view.focus_distance);
+            else if (setting == "background")          ok = vector(view.background);
+            else return error("unknown camera setting '" + setting + "'");
+            if (!ok) return false;
+        }
+        if (scene.view.image_width < 1 || scene.view.aspect_ratio <= 0) return error("the image would be empty");
+        return true;
+    }
+
+    bool texture_statement() {
+        scene_texture t;
+        std::string kind;
+        if (!new_name(texture_names, "texture", int32_t(scene.textures.size())) || !word(kind)) return false;
+
+        bool ok;
+        if (kind == "solid") {
+            t.kind = scene_texture_kind::solid;
+            ok = vector(t.value);
+        } else if (kind == "checker") {
+            t.kind = scene_texture_kind::checker;
+            ok = number(t.scale) && name(texture_names, "texture", t.even) && name(texture_names, "texture", t.odd);
+            if (ok && t.scale == 0) return error("the checker scale must not be 0");
+        } else {
+            return error("unknown texture kind '" + kind + "'");
+        }
+        if (ok) scene.textures.push_back(t);
+        return ok;
+    }
+
+    bool material_statement() {
+        scene_material m;
+        std::string kind;
+        if (!new_name(material_names, "material", int32_t(scene.materials.size())) || !word(kind)) return false;
+
+        bool ok;
+        if (kind == "lambertian") {
+            m.kind = scene_material_kind::lambertian;
+            ok = colour_or_texture(m);
+        } else if (kind == "metal") {
+            m.kind = scene_material_kind::metal;
+            ok = vector(m.value) && number(m.parameter);
+        } else if (kind == "dielectric") {
+            m.kind = scene_material_kind::dielectric;
+            ok = number(m.parameter);
+        } else if (kind == "diffuse_light") {
+            m.kind = scene_material_kind::diffuse_light;
+            ok = colour_or_texture(m);
+        } else {
+            return error("unknown material kind '" + kind + "'");
+        }
+        if (ok) scene.materials.push_back(m);
+        return ok;
+    }
+};
+
+inline bool parse_scene(const std::string& text, const std::string& path, scene_description& scene) {
+    // path only names the file in error messages.
+    scene = scene_description();
+    return scene_parser(path, scene).parse(text);
+}
+
+inline bool load_scene_file(const std::string& path, scene_description& scene) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::clog << "Could not open the scene '" << path << "'.\n";
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return parse_scene(text, path, scene);
+}
+
+#endif
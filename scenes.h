@@ -0,0 +1,132 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rtweekend.h"
+
+#include "material.h"
+#include "primitive_arrays.h"
+#include "texture.h"
+
+// Scene geometry, shared by the renderer and the benchmarks. Each scene adds its materials to the
+// given table; cameras are set up by the callers.
+
+inline scene_geometry random_spheres_scene(material_table& materials) {
+    scene_geometry world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.spheres.add(point3(0,-1000,0), 1000, materials.add(make_shared<lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                material_id sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = materials.add(make_shared<lambertian>(albedo));
+                    auto center2 = center + vec3(0, random_double(0, 0.5), 0);
+                    world.spheres.add(center, center2, 0.2, sphere_material);
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = materials.add(make_shared<metal>(albedo, fuzz));
+                    world.spheres.add(center, 0.2, sphere_material);
+                } else {
+                    // glass
+                    sphere_material = materials.add(make_shared<dielectric>(1.5));
+                    world.spheres.add(center, 0.2, sphere_material);
+                }
+            }
+        }
+    }
+
+    auto material1 = materials.add(make_shared<dielectric>(1.5));
+    world.spheres.add(point3(0, 1, 0), 1.0, material1);
+
+    auto material2 = materials.add(make_shared<lambertian>(color(0.4, 0.2, 0.1)));
+    world.spheres.add(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = materials.add(make_shared<metal>(color(0.7, 0.6, 0.5), 0.0));
+    world.spheres.add(point3(4, 1, 0), 1.0, material3);
+
+    return world;
+}
+
+inline scene_geometry two_spheres_scene(material_table& materials) {
+    scene_geometry world;
+
+    auto checker = make_shared<checker_texture>(0.8, color(.2, .3, .1), color(.9, .9, .9));
+
+    auto checker_material = materials.add(make_shared<lambertian>(checker));
+
+    world.spheres.add(point3(0,-10, 0), 10, checker_material);
+    world.spheres.add(point3(0, 10, 0), 10, checker_material);
+
+    return world;
+}
+
+inline scene_geometry quads_scene(material_table& materials) {
+    scene_geometry world;
+
+    // Materials
+    auto left_red     = materials.add(make_shared<lambertian>(color(1.0, 0.2, 0.2)));
+    auto back_green   = materials.add(make_shared<lambertian>(color(0.2, 1.0, 0.2)));
+    auto right_blue   = materials.add(make_shared<lambertian>(color(0.2, 0.2, 1.0)));
+    auto upper_orange = materials.add(make_shared<lambertian>(color(1.0, 0.5, 0.0)));
+    auto lower_teal   = materials.add(make_shared<lambertian>(color(0.2, 0.8, 0.8)));
+
+    // Quads
+    world.quads.add(point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red);
+    world.quads.add(point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green);
+    world.quads.add(point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue);
+    world.quads.add(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange);
+    world.quads.add(point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal);
+
+    return world;
+}
+
+inline void add_box(scene_geometry& world, const point3& a, const point3& b, material_id mat) {
+    // The six sides of the axis-aligned box with opposite corners a and b.
+    auto min = point3(std::fmin(a.x(),b.x()), std::fmin(a.y(),b.y()), std::fmin(a.z(),b.z()));
+    auto max = point3(std::fmax(a.x(),b.x()), std::fmax(a.y(),b.y()), std::fmax(a.z(),b.z()));
+
+    auto dx = vec3(max.x() - min.x(), 0, 0);
+    auto dy = vec3(0, max.y() - min.y(), 0);
+    auto dz = vec3(0, 0, max.z() - min.z());
+
+    world.quads.add(point3(min.x(), min.y(), max.z()),  dx,  dy, mat); // front
+    world.quads.add(point3(max.x(), min.y(), max.z()), -dz,  dy, mat); // right
+    world.quads.add(point3(max.x(), min.y(), min.z()), -dx,  dy, mat); // back
+    world.quads.add(point3(min.x(), min.y(), min.z()),  dz,  dy, mat); // left
+    world.quads.add(point3(min.x(), max.y(), max.z()),  dx, -dz, mat); // top
+    world.quads.add(point3(min.x(), min.y(), min.z()),  dx,  dz, mat); // bottom
+}
+
+inline scene_geometry cornell_box_scene(material_table& materials) {
+    // Closed box lit only by a small quad light in the ceiling.
+    scene_geometry world;
+
+    auto red   = materials.add(make_shared<lambertian>(color(.65, .05, .05)));
+    auto white = materials.add(make_shared<lambertian>(color(.73, .73, .73)));
+    auto green = materials.add(make_shared<lambertian>(color(.12, .45, .15)));
+    auto light = materials.add(make_shared<diffuse_light>(color(15, 15, 15)));
+
+    world.quads.add(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green);
+    world.quads.add(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red);
+    world.quads.add(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light);
+    world.quads.add(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white);
+    world.quads.add(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white);
+    world.quads.add(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white);
+
+    add_box(world, point3(130, 0, 65), point3(295, 165, 230), white);
+    add_box(world, point3(265, 0, 295), point3(430, 330, 460), white);
+
+    return world;
+}
+
+#endif
@@ -7,14 +7,14 @@
 class sphere : public hittable {
     public:
     // Stationary Sphere 
-    sphere(point3 _center, double _radius, shared_ptr<material> _material) 
+    sphere(point3 _center, real _radius, material_id _material) 
         : center1(_center), radius(_radius), mat(_material), is_moving(false) {
             auto rvec = vec3(radius,radius,radius);
             bbox = aabb(center1 - rvec, center1 + rvec);
         }
     
     // Moving Sphere 
-    sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material) 
+    sphere(point3 _center1, point3 _center2, real _radius, material_id _material) 
         : center1(_center1), radius(_radius), mat(_material), is_moving(true)  {
             
             auto rvec = vec3(radius,radius,radius);
@@ -26,55 +26,79 @@ class sphere : public hittable {
 
         }
     
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const  override {
-        point3 center = is_moving ? sphere_center(r.time()): center1;
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - radius*radius;
-
-        auto discriminant = half_b*half_b - a*c;
-        if (discriminant < 0) return false;
-        auto sqrtd = sqrt(discriminant);
-
-        //Find the nearest root that lies in the acceptable range.
-        auto root = (-half_b - sqrtd) / a;
-        if (!ray_t.surrounds(root)){
-            root = (-half_b + sqrtd) / a;
-            if (!ray_t.surrounds(root)) return false;
-        }
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        real root;
+        if (!nearest_root(r, ray_t, root)) return false;
 
         rec.t = root;
+        rec.object = this;
+        return true;
+    }
+
+    void finalize_interaction(const ray& r, hit_record& rec) const override {
         rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - center) / radius;
+        vec3 outward_normal = (rec.p - sphere_center(r.time())) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
+    }
 
-        return true;
+    bool occluded(const ray& r, interval ray_t) const override {
+        real root;
+        return nearest_root(r, ray_t, root);
     }
 
     aabb bounding_box() const override { return bbox;}
 
+    static void get_sphere_uv(const point3& p, real& u, real& v) {
+        // Texture coordinates of a point p on the unit sphere.
+        auto theta = acos(-p.y());
+        auto phi = atan2(-p.z(), p.x()) + pi;
+
+        u = phi / (2*pi);
+        v = theta / pi;
+    }
+
     private:
     point3 center1;
-    double radius;
-    shared_ptr<material> mat;
+    real radius;
+    material_id mat;
     bool is_moving;
     vec3 center_vec;
     aabb bbox;
 
-    point3 sphere_center(double time) const {
+    point3 sphere_center(real time) const {
         // t=0 yields Center1 and t=1 yields center2.
-        return center1 + time*center_vec;
+        return is_moving ? center1 + time*center_vec : center1;
     }
 
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
-        auto theta = acos(-p.y());
-        auto phi = atan2(-p.z(), p.x()) + pi;
+    bool nearest_root(const ray& r, const interval& ray_t, real& root) const {
+        // Nearest ray parameter within ray_t at which r meets the sphere.
+        vec3 oc = r.origin() - sphere_center(r.time());
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius*radius;
 
-        u = phi / (2*pi);
-        v = theta / pi;
+        // The discriminant half_b*half_b - a*c cancels badly in single precision for distant or
+        // large spheres. Rewrite it with the distance from the centre to the ray's line instead.
+        vec3 perpendicular = oc - (half_b / a) * r.direction();
+        auto discriminant = a * (radius*radius - perpendicular.length_squared());
+        if (discriminant < 0) return false;
+        auto sqrtd = sqrt(discriminant);
+
+        // Stable pair of roots: q never subtracts two nearly equal values.
+        auto q = -(half_b + std::copysign(sqrtd, half_b));
+        auto root0 = q / a;
+        auto root1 = (q != 0) ? c / q : root0;
+        if (root1 < root0) std::swap(root0, root1);
+
+        //Find the nearest root that lies in the acceptable range.
+        root = root0;
+        if (!ray_t.surrounds(root)){
+            root = root1;
+            if (!ray_t.surrounds(root)) return false;
+        }
+        return true;
     }
 };
 
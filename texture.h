@@ -6,15 +6,15 @@
 class texture {
     public:
     virtual ~texture() = default;
-    virtual color value (double u, double v, const point3& p) const = 0;
+    virtual color value (real u, real v, const point3& p) const = 0;
 };
 
 class solid_color : public texture {
     public:
     solid_color(color c) : color_value(c) {};
-    solid_color(double red, double green, double blue) : solid_color(color(red, green, blue)) {}
+    solid_color(real red, real green, real blue) : solid_color(color(red, green, blue)) {}
     
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         return color_value;
     }
 
@@ -24,12 +24,12 @@ class solid_color : public texture {
 
 class checker_texture : public texture {
     public:
-    checker_texture(double _scale, shared_ptr<texture> _even, shared_ptr<texture> _odd) 
+    checker_texture(real _scale, shared_ptr<texture> _even, shared_ptr<texture> _odd) 
             : inv_scale(1/_scale), even(_even) ,odd(_odd) {}
-    checker_texture(double _scale, color c1, color c2) 
+    checker_texture(real _scale, color c1, color c2) 
             : inv_scale(1/_scale), even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         auto xInteger = static_cast<int>(std::floor(inv_scale * p.x()));
         auto yInteger = static_cast<int>(std::floor(inv_scale * p.y()));
         auto zInteger = static_cast<int>(std::floor(inv_scale * p.z()));
@@ -40,7 +40,7 @@ class checker_texture : public texture {
     }
 
     private:
-    double inv_scale;
+    real inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
@@ -0,0 +1,165 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Work-stealing thread pool.
+   Every worker owns a task queue. A worker pops its newest task first and, when its own queue
+   runs dry, steals the oldest task from another worker. The thread that owns the pool counts as
+   worker 0: it only runs tasks while it is blocked in wait(), so a pool of size 1 runs every task
+   on the calling thread.
+*/
+
+class thread_pool {
+    public:
+    // A thread count of 0 (or less) uses one worker per hardware thread.
+    explicit thread_pool(int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = static_cast<int>(std::thread::hardware_concurrency());
+        thread_count = std::max(thread_count, 1);
+
+        for (int i = 0; i < thread_count; i++)
+            queues.push_back(std::make_unique<task_queue>());
+
+        for (int i = 1; i < thread_count; i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int size() const { return static_cast<int>(queues.size()); }
+
+    void submit(std::function<void()> task) {
+        // Tasks spawned by a worker stay on its own queue, others are dealt round-robin.
+        int index = (current_pool == this)
+                  ? current_index
+                  : static_cast<int>(next_queue++ % queues.size());
+
+        pending++;
+        {
+            std::lock_guard<std::mutex> guard(queues[index]->lock);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        queued++;
+        wake.notify_one();
+    }
+
+    void wait() {
+        // Block until every submitted task has finished, running queued tasks in the meantime.
+        wait(pending);
+    }
+
+    void wait(const std::atomic<int>& remaining) {
+        // Block until `remaining` drops to zero, running queued tasks in the meantime. Tasks use
+        // this to join the subtasks they spawned without waiting on the whole pool.
+        auto previous_pool = current_pool;
+        auto previous_index = current_index;
+        if (current_pool != this) {
+            current_pool = this;
+            current_index = 0;
+        }
+
+        while (remaining > 0) {
+            if (!run_one(current_index))
+                std::this_thread::yield();
+        }
+
+        current_pool = previous_pool;
+        current_index = previous_index;
+    }
+
+    private:
+    struct task_queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{0};  // Tasks sitting in a queue.
+    std::atomic<int> pending{0}; // Tasks submitted but not yet finished.
+    std::atomic<unsigned> next_queue{0};
+
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static inline thread_local thread_pool* current_pool = nullptr;
+    static inline thread_local int current_index = 0;
+
+    void worker_loop(int index) {
+        current_pool = this;
+        current_index = index;
+
+        while (true) {
+            if (run_one(index))
+                continue;
+
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            if (stopping)
+                return;
+            // Timed wait so a notify racing with this check cannot park the worker for good.
+            wake.wait_for(guard, std::chrono::milliseconds(1), [this] { return stopping || queued > 0; });
+        }
+    }
+
+    bool run_one(int index) {
+        std::function<void()> task;
+        if (!pop_own(index, task) && !steal(index, task))
+            return false;
+
+        task();
+        pending--;
+        return true;
+    }
+
+    bool pop_own(int index, std::function<void()>& task) {
+        auto& queue = *queues[index];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            return false;
+
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool steal(int index, std::function<void()>& task) {
+        auto count = static_cast<int>(queues.size());
+        for (int offset = 1; offset < count; offset++) {
+            auto& queue = *queues[(index + offset) % count];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty())
+                continue;
+
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued--;
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+
+#include <algorithm>
+
+/* Affine transforms.
+   A 3x4 matrix: a linear part and a translation. Transforms compose with *, the right-hand one
+   applying first, so translation(t) * rotation(axis, angle) * scaling(s) scales an object, then
+   rotates it, then moves it into place.
+*/
+
+class affine_transform {
+    public:
+    affine_transform() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+    static affine_transform translation(const vec3& offset) {
+        affine_transform t;
+        for (int row = 0; row < 3; row++) t.m[row][3] = offset[row];
+        return t;
+    }
+
+    static affine_transform scaling(const vec3& factors) {
+        affine_transform t;
+        for (int row = 0; row < 3; row++) t.m[row][row] = factors[row];
+        return t;
+    }
+
+    static affine_transform rotation(const vec3& axis, real degrees) {
+        // Counterclockwise, looking down the axis towards the origin (Rodrigues' formula).
+        auto a = unit_vector(axis);
+        auto theta = degrees_to_radians(degrees);
+        auto c = std::cos(theta), s = std::sin(theta), k = 1 - c;
+
+        affine_transform t;
+        t.m[0][0] = c + a.x()*a.x()*k;         t.m[0][1] = a.x()*a.y()*k - a.z()*s; t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+        t.m[1][0] = a.y()*a.x()*k + a.z()*s;   t.m[1][1] = c + a.y()*a.y()*k;       t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+        t.m[2][0] = a.z()*a.x()*k - a.y()*s;   t.m[2][1] = a.z()*a.y()*k + a.x()*s; t.m[2][2] = c + a.z()*a.z()*k;
+        return t;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                      m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                      m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                    m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                    m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const {
+        // The transpose of the linear part times v. Applied by the inverse transform, this maps
+        // normals, which stay perpendicular to the transformed surface.
+        return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                    m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                    m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+
+    aabb apply_box(const aabb& box) const {
+        // Bounds of the eight transformed corners.
+        aabb result;
+        for (int corner = 0; corner < 8; corner++) {
+            point3 p((corner & 1) ? box.x.max : box.x.min,
+                     (corner & 2) ? box.y.max : box.y.min,
+                     (corner & 4) ? box.z.max : box.z.min);
+            auto q = apply_point(p);
+            result = aabb(result, aabb(q, q));
+        }
+        return result;
+    }
+
+    affine_transform inverse() const {
+        // Adjugate over determinant for the linear part, then the translation undone.
+        affine_transform t;
+        auto det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        auto inv_det = 1 / det;
+        t.m[0][0] = (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        t.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+        t.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        t.m[1][0] = (m[1][2]*m[2][0] - m[1][0]*m[2][2]) * inv_det;
+        t.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        t.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+        t.m[2][0] = (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        t.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+        t.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        auto offset = t.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int row = 0; row < 3; row++) t.m[row][3] = -offset[row];
+        return t;
+    }
+
+    friend affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+        affine_transform t;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 4; col++) {
+                t.m[row][col] = a.m[row][0]*b.m[0][col] + a.m[row][1]*b.m[1][col] + a.m[row][2]*b.m[2][col];
+                if (col == 3) t.m[row][col] += a.m[row][3];
+            }
+        }
+        return t;
+    }
+
+    private:
+    real m[3][4];
+};
+
+#endif
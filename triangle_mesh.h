@@ -0,0 +1,249 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* Indexed triangle meshes.
+   A mesh keeps one copy of its vertex data, shared by all of its triangles, and names the three
+   corners of each triangle by index. It carries its own flattened BVH over the triangles, so the
+   scene's hierarchy sees the whole mesh as a single primitive. Rays meet triangles with the
+   watertight test of Woop, Benthin and Wald (JCGT 2013): a ray through an edge or vertex shared
+   by several triangles hits at least one of them, so closed meshes have no cracks.
+*/
+
+// Vertex data of a mesh and the triangles over it. Normals and texture coordinates have their own
+// index lists, as in OBJ files, so a position shared by faces with different normals is stored once.
+class mesh_data {
+    public:
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<real> uvs; // Pairs of texture coordinates u, v.
+
+    std::vector<uint32_t> position_indices; // Three per triangle.
+    std::vector<uint32_t> normal_indices;   // Three per triangle, or none for flat shading.
+    std::vector<uint32_t> uv_indices;       // Three per triangle, or none.
+
+    size_t triangle_count() const { return position_indices.size() / 3; }
+
+    aabb bounding_box(size_t i) const {
+        const auto& p0 = positions[position_indices[3*i]];
+        const auto& p1 = positions[position_indices[3*i + 1]];
+        const auto& p2 = positions[position_indices[3*i + 2]];
+        return aabb(aabb(p0, p1), aabb(p2, p2)).pad();
+    }
+};
+
+class triangle_mesh : public hittable {
+    public:
+    triangle_mesh(mesh_data data_param, material_id mat_param, const bvh_build_options& options = bvh_build_options())
+        : mesh(std::move(data_param)), mat(mat_param) {
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(mesh.triangle_count(), [&](size_t i) { return mesh.bounding_box(i); }, &pool);
+
+        auto tree = linear_bvh_builder(refs, &pool).build(options);
+        nodes = std::move(tree.nodes);
+
+        // Put the triangles in leaf order, so that every leaf is one contiguous range of them.
+        for (auto* indices : {&mesh.position_indices, &mesh.normal_indices, &mesh.uv_indices}) {
+            if (indices->empty()) continue;
+            std::vector<uint32_t> reordered(indices->size());
+            for (size_t i = 0; i < tree.order.size(); i++)
+                for (int corner = 0; corner < 3; corner++)
+                    reordered[3*i + corner] = (*indices)[3*size_t(tree.order[i]) + corner];
+            indices->swap(reordered);
+        }
+
+        for (size_t i = 0; i < mesh.triangle_count(); i++)
+            bbox = aabb(bbox, mesh.bounding_box(i));
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        sheared_ray sheared(r);
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        size_t closest = 0;
+        real closest_b1 = 0, closest_b2 = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++) {
+                        real t, b1, b2;
+                        if (hit_triangle(sheared, i, ray_t, t, b1, b2)) {
+                            ray_t.max = t;
+                            closest = i;
+                            closest_b1 = b1;
+                            closest_b2 = b2;
+                            hit_anything = true;
+                        }
+                    }
+                } else {
+                    // Visit the child nearer along the split axis first, the other one later.
+                    if (r.sign(node.axis)) {
+                        stack[stack_size++] = current + 1;
+                        current = node.offset;
+                    } else {
+                        stack[stack_size++] = node.offset;
+                        current = current + 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+
+        if (!hit_anything) return false;
+
+        // Barycentric coordinates of the hit, for finalize_interaction.
+        rec.t = ray_t.max;
+        rec.u = closest_b1;
+        rec.v = closest_b2;
+        rec.object = this;
+        rec.primitive = static_cast<uint32_t>(closest);
+        return true;
+    }
+
+    void finalize_interaction(const ray& r, hit_record& rec) const override {
+        // Face orientation and the offset of secondary rays follow the geometric normal;
+        // interpolated vertex normals, when the mesh has them, only bend the shading normal on
+        // that side. Offsetting along them could start a ray inside a silhouette triangle.
+        size_t i = rec.primitive;
+        auto b1 = rec.u, b2 = rec.v, b0 = 1 - b1 - b2;
+
+        const auto& p0 = mesh.positions[mesh.position_indices[3*i]];
+        const auto& p1 = mesh.positions[mesh.position_indices[3*i + 1]];
+        const auto& p2 = mesh.positions[mesh.position_indices[3*i + 2]];
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+
+        if (!mesh.normal_indices.empty()) {
+            auto shading = unit_vector(b0 * mesh.normals[mesh.normal_indices[3*i]]
+                                     + b1 * mesh.normals[mesh.normal_indices[3*i + 1]]
+                                     + b2 * mesh.normals[mesh.normal_indices[3*i + 2]]);
+            rec.shading_normal = (dot(shading, rec.normal) < 0) ? -shading : shading;
+        }
+
+        // Texture coordinates from the mesh's, or else the barycentric coordinates left by intersect().
+        if (!mesh.uv_indices.empty()) {
+            auto uv0 = &mesh.uvs[2 * size_t(mesh.uv_indices[3*i])];
+            auto uv1 = &mesh.uvs[2 * size_t(mesh.uv_indices[3*i + 1])];
+            auto uv2 = &mesh.uvs[2 * size_t(mesh.uv_indices[3*i + 2])];
+            rec.u = b0*uv0[0] + b1*uv1[0] + b2*uv2[0];
+            rec.v = b0*uv0[1] + b1*uv1[1] + b2*uv2[1];
+        }
+        rec.mat = mat;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // Same traversal as intersect(), stopping at the first triangle that blocks the ray.
+        if (nodes.empty()) return false;
+
+        sheared_ray sheared(r);
+        uint32_t stack[linear_bvh_builder::max_stack_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            if (linear_bvh_node_hit(node, r, ray_t)) {
+                if (node.primitive_count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.primitive_count; i++) {
+                        real t, b1, b2;
+                        if (hit_triangle(sheared, i, ray_t, t, b1, b2)) return true;
+                    }
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) return false;
+            current = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t triangle_count() const { return mesh.triangle_count(); }
+    size_t node_count() const { return nodes.size(); }
+
+    private:
+    // A ray in the frame of the watertight test: the axis along which the direction is largest
+    // becomes z, and a shear turns the direction into (0, 0, 1).
+    struct sheared_ray {
+        point3 origin;
+        int kx, ky, kz;
+        real sx, sy, sz;
+
+        explicit sheared_ray(const ray& r) : origin(r.origin()) {
+            const auto& d = r.direction();
+            kz = (std::fabs(d.x()) > std::fabs(d.y()))
+               ? ((std::fabs(d.x()) > std::fabs(d.z())) ? 0 : 2)
+               : ((std::fabs(d.y()) > std::fabs(d.z())) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            // Keep the winding of the triangles when the direction points down the z axis.
+            if (d[kz] < 0) std::swap(kx, ky);
+
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = 1 / d[kz];
+        }
+    };
+
+    bool hit_triangle(const sheared_ray& s, size_t i, const interval& ray_t, real& t, real& b1, real& b2) const {
+        // Signed edge functions of the sheared triangle around the ray, which passes through the
+        // origin of the xy plane. The ray hits unless they disagree in sign; edges and vertices
+        // give zeros, which count as hits on either side.
+        auto a = mesh.positions[mesh.position_indices[3*i]] - s.origin;
+        auto b = mesh.positions[mesh.position_indices[3*i + 1]] - s.origin;
+        auto c = mesh.positions[mesh.position_indices[3*i + 2]] - s.origin;
+
+        auto ax = a[s.kx] - s.sx*a[s.kz], ay = a[s.ky] - s.sy*a[s.kz];
+        auto bx = b[s.kx] - s.sx*b[s.kz], by = b[s.ky] - s.sy*b[s.kz];
+        auto cx = c[s.kx] - s.sx*c[s.kz], cy = c[s.ky] - s.sy*c[s.kz];
+
+        auto e0 = cx*by - cy*bx;
+        auto e1 = ax*cy - ay*cx;
+        auto e2 = bx*ay - by*ax;
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0)) return false;
+
+        auto det = e0 + e1 + e2;
+        if (det == 0) return false;
+
+        // Distance along the ray, from the scaled z coordinates weighted by the edge functions.
+        auto scaled_t = s.sz * (e0*a[s.kz] + e1*b[s.kz] + e2*c[s.kz]);
+        t = scaled_t / det;
+        if (!ray_t.surrounds(t)) return false;
+
+        b1 = e1 / det;
+        b2 = e2 / det;
+        return true;
+    }
+
+    mesh_data mesh;
+    material_id mat;
+    std::vector<linear_bvh_node> nodes; // Leaf offsets index the triangles, in leaf order.
+    aabb bbox;
+};
+
+#endif
@@ -7,27 +7,33 @@
 // Moving sqrt from cmath to the current scope
 using std::sqrt;
 
-class vec3 {
+// Three component vector over the scalar type T. The renderer uses vec3 = basic_vec3<real>.
+template <typename T>
+class basic_vec3 {
     public:
-        double e[3];
+        T e[3];
 
-        // Create a vec3 class that initialises with {0, 0, 0} or with provided double parameters.
-        vec3() : e{0, 0, 0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        // Create a vec3 class that initialises with {0, 0, 0} or with provided scalar parameters.
+        basic_vec3() : e{0, 0, 0} {}
+        basic_vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
+
+        // Convert between scalar types, e.g. a double precision vector to a single precision one.
+        template <typename U>
+        explicit basic_vec3(const basic_vec3<U>& v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
         // Create classes that return each of the points in a vector.
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const { return e[2]; }
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        // Get vector element -- double point = myvect[1];
-        double operator[] (int i) const { return e[i]; }
+        basic_vec3 operator-() const { return basic_vec3(-e[0], -e[1], -e[2]); }
+        // Get vector element -- real point = myvect[1];
+        T operator[] (int i) const { return e[i]; }
         // Set vector element -- myvect[1] = 5.0;
-        double& operator[] (int i) { return e[i]; }
+        T& operator[] (int i) { return e[i]; }
 
         // Vector Addition operator
-        vec3& operator+=(const vec3 &v)
+        basic_vec3& operator+=(const basic_vec3 &v)
         {
             e[0] += v.e[0];
             e[1] += v.e[1];
@@ -35,8 +41,8 @@ class vec3 {
             return *this;
         }
 
-        // Multiply vector by an integer
-        vec3& operator*=(double t)
+        // Multiply vector by a scalar
+        basic_vec3& operator*=(T t)
         {
             e[0] *= t;
             e[1] *= t;
@@ -44,78 +50,98 @@ class vec3 {
 
             return *this;
         }
-        
-        vec3& operator/=( double t) { return *this *= 1/t; }
 
-        double length() const { return sqrt(length_squared()); }
+        basic_vec3& operator/=(T t) { return *this *= 1/t; }
+
+        T length() const { return sqrt(length_squared()); }
 
-        double length_squared() const { return e[0]* e[0] + e[1]* e[1] + e[2]* e[2]; }
+        T length_squared() const { return e[0]* e[0] + e[1]* e[1] + e[2]* e[2]; }
 
         bool near_zero() const {
-            auto s = 1e-8;
-            return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+            T s = 1e-8;
+            return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
         }
 
-        static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        static basic_vec3 random() {
+            return basic_vec3(random_double(), random_double(), random_double());
         }
-        static vec3 random(double min, double max) {
-            return vec3(random_double(min, max), random_double(min,max), random_double(min, max));
+        static basic_vec3 random(double min, double max) {
+            return basic_vec3(random_double(min, max), random_double(min,max), random_double(min, max));
         }
-};
 
-// Clarification: using point3 as alias for vec3;
-using point3 = vec3;
+        // Arithmetic operators are friends so that scalars of another type convert to T,
+        // e.g. 0.5 * v with a single precision v.
 
-// Vector Utility Functions
+        // Return to the stream (file, cout, etc) the vector indicated.
+        friend std::ostream& operator<<(std::ostream &out, const basic_vec3 &v) { return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2]; }
 
-// Return to the stream (file, cout, etc) the vector indicated.
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) { return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2]; }
+        friend basic_vec3 operator+(const basic_vec3 &u, const basic_vec3 &v) { return basic_vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]); }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) { return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]); }
+        friend basic_vec3 operator-(const basic_vec3 &u, const basic_vec3 &v) { return basic_vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]); }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) { return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]); }
+        friend basic_vec3 operator*(const basic_vec3 &u, const basic_vec3 &v) { return basic_vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]); }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) { return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]); }
+        friend basic_vec3 operator*(T t, const basic_vec3 &v) { return basic_vec3(t * v.e[0], t * v.e[1], t * v.e[2]); }
 
-inline vec3 operator*(double t, const vec3 &v) { return vec3(t * v.e[0], t * v.e[1], t * v.e[2]); }
+        friend basic_vec3 operator*(const basic_vec3 &v, T t) { return t * v; }
 
-inline vec3 operator*(const vec3 &v, double t) { return t * v; }
+        friend basic_vec3 operator/(basic_vec3 v, T t) { return (1/t) * v; }
+};
 
-inline vec3 operator/(vec3 v, double t) { return (1/t) * v; }
+// Clarification: vec3 and its point3 alias use the renderer's scalar type.
+using vec3 = basic_vec3<real>;
+using point3 = vec3;
 
-inline double dot(const vec3 &u, const vec3 &v) {
-    return u.e[0] * v.e[0] 
-         + u.e[1] * v.e[1] 
-         + u.e[2] * v.e[2]; 
+// Vector Utility Functions
+
+template <typename T>
+inline T dot(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+    return u.e[0] * v.e[0]
+         + u.e[1] * v.e[1]
+         + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) { 
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline basic_vec3<T> cross(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+    return basic_vec3<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                         u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                         u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(vec3 v) { return v / v.length(); }
+template <typename T>
+inline basic_vec3<T> unit_vector(basic_vec3<T> v) { return v / v.length(); }
+
+// Direct mappings from uniform numbers: each sample costs a fixed number of random_double() calls,
+// which keeps the dimensions of a sampler (sampler.h) lined up from one sample to the next.
 
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() < 1)
-            return p;
+    // Concentric map of the square [-1, 1]^2 onto the disk (Shirley and Chiu).
+    real a = 2*random_double() - 1;
+    real b = 2*random_double() - 1;
+    if (a == 0 && b == 0) return vec3(0, 0, 0);
+
+    real r, phi;
+    if (a*a > b*b) {
+        r = a;
+        phi = (pi/4) * (b/a);
+    } else {
+        r = b;
+        phi = (pi/2) - (pi/4) * (a/b);
     }
+    return vec3(r*std::cos(phi), r*std::sin(phi), 0);
 }
 
-inline vec3 random_in_unit_sphere() {
-    // Get a random vector on the sphere
-    while (true) {
-        auto p = vec3::random(-1, 1);
-        if (p.length_squared() < 1) return p;
-    }
+inline vec3 random_unit_vector() {
+    // Uniform on the sphere: height uniform in [-1, 1], angle uniform around the axis.
+    real z = 1 - 2*random_double();
+    real r = sqrt(std::fmax(real(0), 1 - z*z));
+    real phi = 2*pi*random_double();
+    return vec3(r*std::cos(phi), r*std::sin(phi), z);
 }
 
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+inline vec3 random_in_unit_sphere() {
+    // Uniform in the ball: a uniform direction at a radius with a cubic distribution.
+    return random_unit_vector() * real(std::cbrt(random_double()));
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {
@@ -130,10 +156,10 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2*dot(v,n)*n;
 }
 
-inline vec3 refract(const vec3& incident, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-incident, n), 1.0);
+inline vec3 refract(const vec3& incident, const vec3& n, real etai_over_etat) {
+    auto cos_theta = std::fmin(dot(-incident, n), real(1));
     vec3 r_out_perp =  etai_over_etat * (incident + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    vec3 r_out_parallel = -sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
-#endif 
\ No newline at end of file
+#endif
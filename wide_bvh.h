@@ -0,0 +1,337 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/* Wide BVH (QBVH / OBVH).
+   A binary SAH tree is collapsed so that every node holds the bounds of up to wide_bvh_width
+   children in structure-of-arrays layout, and one SIMD slab test intersects all of them at once.
+   The width follows the instruction set the file is compiled for: 8 with AVX2, 4 with SSE2, and
+   4 with a scalar loop otherwise (or when RT_NO_SIMD is defined).
+*/
+
+#if defined(__AVX2__) && !defined(RT_NO_SIMD)
+#include <immintrin.h>
+#define RT_WIDE_BVH_AVX2
+const int wide_bvh_width = 8;
+#elif (defined(__SSE2__) || defined(_M_X64)) && !defined(RT_NO_SIMD)
+#include <emmintrin.h>
+#define RT_WIDE_BVH_SSE
+const int wide_bvh_width = 4;
+#else
+const int wide_bvh_width = 4;
+#endif
+
+struct alignas(32) wide_bvh_node {
+    // Child bounds, one array per slab: min x, min y, min z, max x, max y, max z.
+    float bounds[6][wide_bvh_width];
+    int32_t child[wide_bvh_width];  // Node index, first primitive of a leaf, or -1 when unused.
+    uint16_t count[wide_bvh_width]; // Primitives in a leaf child, 0 for node children.
+};
+
+class wide_bvh : public hittable {
+    public:
+    wide_bvh(const hittable_list& list, const bvh_build_options& options = bvh_build_options()) {
+        thread_pool pool(options.thread_count);
+        auto refs = bvh_gather_refs(list.objects, &pool);
+        if (refs.empty()) return;
+
+        // Build a binary tree first, then collapse it into wide nodes.
+        std::vector<binary_node> binary;
+        binary.reserve(2 * refs.size());
+        build_binary(binary, refs, 0, refs.size(), options, &pool);
+
+        primitives.reserve(refs.size());
+        nodes.reserve(binary.size() / 2 + 1);
+        nodes.push_back(wide_bvh_node());
+        if (binary[0].left < 0) {
+            // A single leaf: wrap it in a root node with one child.
+            clear_node(nodes[0]);
+            set_child(nodes[0], 0, binary, 0, list.objects, refs);
+        } else {
+            collapse(0, binary, list.objects, refs);
+        }
+
+        bbox = list.bounding_box();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) return false;
+
+        ray_constants rc(r);
+
+        stack_entry stack[max_stack_depth];
+        int stack_size = 0;
+        stack[stack_size++] = {0, 0, static_cast<float>(ray_t.min)};
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+            if (entry.t_near > ray_t.max) continue;
+
+            if (entry.count > 0) {
+                for (int i = entry.index; i < entry.index + entry.count; i++) {
+                    if (primitives[i]->intersect(r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            const auto& node = nodes[entry.index];
+            float t_near[wide_bvh_width];
+            auto mask = intersect_children(node, rc, ray_t, t_near);
+
+            // Push hit children far-to-near, so the nearest one is popped first.
+            stack_entry hits[wide_bvh_width];
+            int hit_count = 0;
+            for (int c = 0; c < wide_bvh_width; c++) {
+                if (!(mask & (1u << c))) continue;
+                stack_entry child = {node.child[c], node.count[c], t_near[c]};
+                int k = hit_count++;
+                while (k > 0 && hits[k-1].t_near < child.t_near) {
+                    hits[k] = hits[k-1];
+                    k--;
+                }
+                hits[k] = child;
+            }
+            for (int k = 0; k < hit_count; k++)
+                stack[stack_size++] = hits[k];
+        }
+
+        return hit_anything;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // Same traversal as hit(), in any order, stopping at the first primitive that blocks the ray.
+        if (nodes.empty()) return false;
+
+        ray_constants rc(r);
+
+        stack_entry stack[max_stack_depth];
+        int stack_size = 0;
+        stack[stack_size++] = {0, 0, static_cast<float>(ray_t.min)};
+
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+
+            if (entry.count > 0) {
+                for (int i = entry.index; i < entry.index + entry.count; i++)
+                    if (primitives[i]->occluded(r, ray_t)) return true;
+                continue;
+            }
+
+            const auto& node = nodes[entry.index];
+            float t_near[wide_bvh_width];
+            auto mask = intersect_children(node, rc, ray_t, t_near);
+            for (int c = 0; c < wide_bvh_width; c++)
+                if (mask & (1u << c))
+                    stack[stack_size++] = {node.child[c], node.count[c], t_near[c]};
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    private:
+    // Each level of the tree leaves at most width-1 entries behind on the stack.
+    static const int max_stack_depth = 128 * wide_bvh_width;
+
+    struct binary_node {
+        aabb box;
+        int left = -1, right = -1;
+        size_t start = 0, end = 0; // Primitive reference range of a leaf.
+    };
+
+    struct stack_entry {
+        int32_t index;
+        uint16_t count;
+        float t_near;
+    };
+
+    struct ray_constants {
+        // Single precision ray data, with the near and far slab of each axis picked by the sign.
+        float origin[3];
+        float invert_dir[3];
+        int near_slab[3], far_slab[3];
+
+        ray_constants(const ray& r) {
+            for (int a = 0; a < 3; a++) {
+                origin[a] = static_cast<float>(r.origin()[a]);
+                invert_dir[a] = static_cast<float>(r.invert_direction()[a]);
+                near_slab[a] = r.sign(a) ? a + 3 : a;
+                far_slab[a] = r.sign(a) ? a : a + 3;
+            }
+        }
+    };
+
+    std::vector<wide_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bbox;
+
+    static unsigned intersect_children(const wide_bvh_node& node, const ray_constants& rc,
+                                       const interval& ray_t, float* t_near) {
+        // Slab test against every child at once. Returns a bit mask of the children hit and
+        // stores their entry distances. A lane whose slab distance is NaN (a zero direction
+        // component with the origin on the slab plane) ignores that axis; min/max keep their
+        // second operand when the first is NaN, so the ray interval always goes second.
+        // The far distance is widened slightly to cover the single precision rounding.
+        const float t_min = static_cast<float>(ray_t.min);
+        const float t_max = static_cast<float>(ray_t.max) * 1.0000004f;
+
+#if defined(RT_WIDE_BVH_AVX2)
+        __m256 near_t = _mm256_set1_ps(t_min);
+        __m256 far_t = _mm256_set1_ps(t_max);
+        for (int a = 0; a < 3; a++) {
+            auto o = _mm256_set1_ps(rc.origin[a]);
+            auto inv = _mm256_set1_ps(rc.invert_dir[a]);
+            auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[rc.near_slab[a]]), o), inv);
+            auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[rc.far_slab[a]]), o), inv);
+            near_t = _mm256_max_ps(t0, near_t);
+            far_t = _mm256_min_ps(t1, far_t);
+        }
+        _mm256_storeu_ps(t_near, near_t);
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(near_t, far_t, _CMP_LE_OQ)));
+#elif defined(RT_WIDE_BVH_SSE)
+        __m128 near_t = _mm_set1_ps(t_min);
+        __m128 far_t = _mm_set1_ps(t_max);
+        for (int a = 0; a < 3; a++) {
+            auto o = _mm_set1_ps(rc.origin[a]);
+            auto inv = _mm_set1_ps(rc.invert_dir[a]);
+            auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[rc.near_slab[a]]), o), inv);
+            auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[rc.far_slab[a]]), o), inv);
+            near_t = _mm_max_ps(t0, near_t);
+            far_t = _mm_min_ps(t1, far_t);
+        }
+        _mm_storeu_ps(t_near, near_t);
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(near_t, far_t)));
+#else
+        unsigned mask = 0;
+        for (int c = 0; c < wide_bvh_width; c++) {
+            float near_t = t_min, far_t = t_max;
+            for (int a = 0; a < 3; a++) {
+                float t0 = (node.bounds[rc.near_slab[a]][c] - rc.origin[a]) * rc.invert_dir[a];
+                float t1 = (node.bounds[rc.far_slab[a]][c] - rc.origin[a]) * rc.invert_dir[a];
+                near_t = (t0 > near_t) ? t0 : near_t;
+                far_t = (t1 < far_t) ? t1 : far_t;
+            }
+            t_near[c] = near_t;
+            if (near_t <= far_t) mask |= 1u << c;
+        }
+        return mask;
+#endif
+    }
+
+    static int build_binary(std::vector<binary_node>& binary, std::vector<bvh_build_ref>& refs,
+                            size_t start, size_t end, bvh_build_options options, thread_pool* pool,
+                            int depth = 0) {
+        // Leaf counts have to fit their 16-bit field, and deep subtrees fall back to median splits.
+        if (depth >= 64)
+            options.method = bvh_split::median;
+
+        auto index = static_cast<int>(binary.size());
+        binary.push_back(binary_node());
+
+        auto mid = bvh_split_range(refs, start, end, options, pool);
+        if (mid == end && end - start > UINT16_MAX)
+            mid = start + (end - start)/2;
+
+        if (mid == end) {
+            aabb box;
+            for (size_t i = start; i < end; i++) box = aabb(box, refs[i].box);
+            binary[index].box = box;
+            binary[index].start = start;
+            binary[index].end = end;
+            return index;
+        }
+
+        auto left = build_binary(binary, refs, start, mid, options, pool, depth+1);
+        auto right = build_binary(binary, refs, mid, end, options, pool, depth+1);
+        binary[index].left = left;
+        binary[index].right = right;
+        binary[index].box = aabb(binary[left].box, binary[right].box);
+        return index;
+    }
+
+    static void clear_node(wide_bvh_node& node) {
+        // Unused slots get inverted bounds, which no ray can hit.
+        for (int c = 0; c < wide_bvh_width; c++) {
+            for (int a = 0; a < 3; a++) {
+                node.bounds[a][c] = std::numeric_limits<float>::infinity();
+                node.bounds[a+3][c] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[c] = -1;
+            node.count[c] = 0;
+        }
+    }
+
+    void set_child(wide_bvh_node& node, int slot, const std::vector<binary_node>& binary, int b,
+                   const std::vector<shared_ptr<hittable>>& src_objects,
+                   const std::vector<bvh_build_ref>& refs) {
+        // Fill a slot's bounds and, for a leaf, copy its primitives into place.
+        const auto& box = binary[b].box;
+        for (int a = 0; a < 3; a++) {
+            node.bounds[a][slot] = linear_bvh_builder::round_down(box.axis(a).min);
+            node.bounds[a+3][slot] = linear_bvh_builder::round_up(box.axis(a).max);
+        }
+
+        if (binary[b].left < 0) {
+            node.child[slot] = static_cast<int32_t>(primitives.size());
+            node.count[slot] = static_cast<uint16_t>(binary[b].end - binary[b].start);
+            for (size_t i = binary[b].start; i < binary[b].end; i++)
+                primitives.push_back(src_objects[refs[i].index]);
+        }
+    }
+
+    void collapse(int b, const std::vector<binary_node>& binary,
+                  const std::vector<shared_ptr<hittable>>& src_objects,
+                  const std::vector<bvh_build_ref>& refs) {
+        // Fill the wide node at the back of the array from binary node b: keep opening the
+        // largest interior child until the node is full, then recurse into the remaining ones.
+        std::vector<int> children = {binary[b].left, binary[b].right};
+        while (static_cast<int>(children.size()) < wide_bvh_width) {
+            int largest = -1;
+            double largest_area = -1;
+            for (int k = 0; k < static_cast<int>(children.size()); k++) {
+                const auto& child = binary[children[k]];
+                if (child.left >= 0 && child.box.surface_area() > largest_area) {
+                    largest_area = child.box.surface_area();
+                    largest = k;
+                }
+            }
+            if (largest < 0) break;
+
+            auto opened = children[largest];
+            children[largest] = binary[opened].left;
+            children.push_back(binary[opened].right);
+        }
+
+        auto index = nodes.size() - 1;
+        clear_node(nodes[index]);
+        for (int slot = 0; slot < static_cast<int>(children.size()); slot++)
+            set_child(nodes[index], slot, binary, children[slot], src_objects, refs);
+
+        for (int slot = 0; slot < static_cast<int>(children.size()); slot++) {
+            if (binary[children[slot]].left < 0) continue;
+
+            nodes[index].child[slot] = static_cast<int32_t>(nodes.size());
+            nodes.push_back(wide_bvh_node());
+            collapse(children[slot], binary, src_objects, refs);
+        }
+    }
+};
+
+#endif